@@ -12,7 +12,7 @@ SettingsDialog::SettingsDialog(ParameterManager& paramManager) : paramManager(pa
     QFormLayout* paramLayout = new QFormLayout(paramWidget);
 
     countSpin = new QSpinBox;
-    countSpin->setRange(1, 1 << 9);
+    countSpin->setRange(1, 1 << 20);
     countSpin->setValue(1 << 4);
 
     // Start and Close buttons
@@ -85,6 +85,67 @@ SettingsDialog::SettingsDialog(ParameterManager& paramManager) : paramManager(pa
     randomSeedSpin->setRange(0, INT_MAX);
     randomSeedSpin->setValue(23);
 
+    // Worker threads for the force computation
+    threadCountSpin = new QSpinBox;
+    threadCountSpin->setRange(1, 256);
+    threadCountSpin->setValue(std::max(std::thread::hardware_concurrency(), 1u));
+    pinThreadsCheckBox = new QCheckBox;
+
+    // Force solver selection; the combo index matches GravityEngine
+    engineCombo = new QComboBox;
+    engineCombo->addItem("Direct summation");
+    engineCombo->addItem("Barnes-Hut octree");
+    engineCombo->addItem("Fast multipole");
+    engineCombo->addItem("Particle mesh (FFT)");
+
+    // Barnes-Hut opening angle and multipole order
+    openingAngleSpin = new QDoubleSpinBox;
+    openingAngleSpin->setRange(0, 1.5);
+    openingAngleSpin->setValue(0.5);
+    openingAngleSpin->setSingleStep(.05);
+    quadrupoleCheckBox = new QCheckBox;
+
+    // FMM expansion order; the opening angle above is shared with the FMM
+    expansionOrderSpin = new QSpinBox;
+    expansionOrderSpin->setRange(1, 10);
+    expansionOrderSpin->setValue(4);
+
+    // Particle-mesh grid resolution and the P3M short-range correction
+    meshSizeCombo = new QComboBox;
+    meshSizeCombo->addItem("32", 32);
+    meshSizeCombo->addItem("64", 64);
+    meshSizeCombo->addItem("128", 128);
+    meshSizeCombo->setCurrentIndex(1);
+    shortRangeCheckBox = new QCheckBox;
+    shortRangeCheckBox->setChecked(true);
+
+    // Integrator, fixed physics step and the substep cap; the combo index
+    //   matches IntegrationScheme
+    integratorCombo = new QComboBox;
+    integratorCombo->addItem("Semi-implicit Euler");
+    integratorCombo->addItem("Leapfrog (KDK)");
+    integratorCombo->addItem("Yoshida 4th order");
+    integratorCombo->addItem("Hermite block steps (direct forces)");
+    timeStepSpin = new QDoubleSpinBox;
+    timeStepSpin->setDecimals(4);
+    timeStepSpin->setRange(0.0005, 0.1);
+    timeStepSpin->setSingleStep(0.001);
+    timeStepSpin->setValue(0.01);
+    maxSubstepsSpin = new QSpinBox;
+    maxSubstepsSpin->setRange(1, 64);
+    maxSubstepsSpin->setValue(8);
+    timeStepAccuracySpin = new QDoubleSpinBox;
+    timeStepAccuracySpin->setDecimals(3);
+    timeStepAccuracySpin->setRange(0.001, 0.2);
+    timeStepAccuracySpin->setSingleStep(0.005);
+    timeStepAccuracySpin->setValue(0.02);
+
+    // How the spheres are drawn; the combo index matches RenderMode
+    renderModeCombo = new QComboBox;
+    renderModeCombo->addItem("Meshes (level of detail)");
+    renderModeCombo->addItem("Ray-cast impostors");
+    renderModeCombo->addItem("Point sprites");
+
     // Fullscreen checkbox
     fullscreenCheckBox = new QCheckBox;
 
@@ -98,6 +159,19 @@ SettingsDialog::SettingsDialog(ParameterManager& paramManager) : paramManager(pa
     paramLayout->addRow("Light fraction: ", lightFractionSpin);
     paramLayout->addRow("Ambient color: ", colorSelectButton);
     paramLayout->addRow("Seed: ", randomSeedSpin);
+    paramLayout->addRow("Physics threads: ", threadCountSpin);
+    paramLayout->addRow("Pin threads to cores (NUMA placement): ", pinThreadsCheckBox);
+    paramLayout->addRow("Gravity solver: ", engineCombo);
+    paramLayout->addRow("Opening angle (theta): ", openingAngleSpin);
+    paramLayout->addRow("Quadrupole moments: ", quadrupoleCheckBox);
+    paramLayout->addRow("FMM expansion order: ", expansionOrderSpin);
+    paramLayout->addRow("PM grid size: ", meshSizeCombo);
+    paramLayout->addRow("PM short-range correction (P3M): ", shortRangeCheckBox);
+    paramLayout->addRow("Integrator: ", integratorCombo);
+    paramLayout->addRow("Physics time step (s): ", timeStepSpin);
+    paramLayout->addRow("Max physics steps to catch up: ", maxSubstepsSpin);
+    paramLayout->addRow("Hermite step accuracy (eta): ", timeStepAccuracySpin);
+    paramLayout->addRow("Sphere rendering: ", renderModeCombo);
     paramLayout->addRow("Fullscreen: ", fullscreenCheckBox);
 
     lowerLayout->addWidget(startCloseWidget);
@@ -188,6 +262,19 @@ void SettingsDialog::setParameters()
     paramManager.setRandSeed(randomSeedSpin->value());
     paramManager.setAmbientPalette(colorPalette);
     paramManager.setSphereCount(countSpin->value());
+    paramManager.setThreadCount(threadCountSpin->value());
+    paramManager.setPinThreads(pinThreadsCheckBox->isChecked());
+    paramManager.setGravityEngine((GravityEngine) engineCombo->currentIndex());
+    paramManager.setOpeningAngle(openingAngleSpin->value());
+    paramManager.setQuadrupoleEnabled(quadrupoleCheckBox->isChecked());
+    paramManager.setExpansionOrder(expansionOrderSpin->value());
+    paramManager.setMeshSize(meshSizeCombo->currentData().toInt());
+    paramManager.setShortRangeEnabled(shortRangeCheckBox->isChecked());
+    paramManager.setIntegrationScheme((IntegrationScheme) integratorCombo->currentIndex());
+    paramManager.setTimeStep(timeStepSpin->value());
+    paramManager.setMaxSubsteps(maxSubstepsSpin->value());
+    paramManager.setTimeStepAccuracy(timeStepAccuracySpin->value());
+    paramManager.setRenderMode((RenderMode) renderModeCombo->currentIndex());
     paramManager.setSunScale(sunRadiusScaleSpin->value());
     paramManager.setFullscreenChecked(fullscreenCheckBox->isChecked());
     writeSettings();
@@ -214,6 +301,19 @@ void SettingsDialog::readSettings()
     lightFractionSpin->setValue(settings.value("lightFraction", .1).toDouble());
     randomSeedSpin->setValue(settings.value("randomSeed", 23).toInt());
     countSpin->setValue(settings.value("sphereCount", 16).toInt());
+    threadCountSpin->setValue(settings.value("threadCount", std::max(std::thread::hardware_concurrency(), 1u)).toInt());
+    pinThreadsCheckBox->setChecked(settings.value("pinThreads", false).toBool());
+    engineCombo->setCurrentIndex(settings.value("gravityEngine", 0).toInt());
+    openingAngleSpin->setValue(settings.value("openingAngle", 0.5).toDouble());
+    quadrupoleCheckBox->setChecked(settings.value("quadrupole", false).toBool());
+    expansionOrderSpin->setValue(settings.value("expansionOrder", 4).toInt());
+    meshSizeCombo->setCurrentIndex(meshSizeCombo->findData(settings.value("meshSize", 64).toInt()));
+    shortRangeCheckBox->setChecked(settings.value("shortRange", true).toBool());
+    integratorCombo->setCurrentIndex(settings.value("integrator", 1).toInt());
+    timeStepSpin->setValue(settings.value("timeStep", 0.01).toDouble());
+    maxSubstepsSpin->setValue(settings.value("maxSubsteps", 8).toInt());
+    timeStepAccuracySpin->setValue(settings.value("timeStepAccuracy", 0.02).toDouble());
+    renderModeCombo->setCurrentIndex(settings.value("renderMode", 0).toInt());
     colorPalette = settings.value("ambientColor", QColor(255, 255, 255)).value<QColor>();
     fullscreenCheckBox->setChecked(settings.value("fullScreenChecked", true).toBool());
     //std::cout << colorPalette.red() << " " << colorPalette.green() << " " << colorPalette.blue() << std::endl;
@@ -236,6 +336,19 @@ void SettingsDialog::writeSettings()
     settings.setValue("lightFraction", lightFractionSpin->value());
     settings.setValue("randomSeed", randomSeedSpin->value());
     settings.setValue("sphereCount", countSpin->value());
+    settings.setValue("threadCount", threadCountSpin->value());
+    settings.setValue("pinThreads", pinThreadsCheckBox->isChecked());
+    settings.setValue("gravityEngine", engineCombo->currentIndex());
+    settings.setValue("openingAngle", openingAngleSpin->value());
+    settings.setValue("quadrupole", quadrupoleCheckBox->isChecked());
+    settings.setValue("expansionOrder", expansionOrderSpin->value());
+    settings.setValue("meshSize", meshSizeCombo->currentData().toInt());
+    settings.setValue("shortRange", shortRangeCheckBox->isChecked());
+    settings.setValue("integrator", integratorCombo->currentIndex());
+    settings.setValue("timeStep", timeStepSpin->value());
+    settings.setValue("maxSubsteps", maxSubstepsSpin->value());
+    settings.setValue("timeStepAccuracy", timeStepAccuracySpin->value());
+    settings.setValue("renderMode", renderModeCombo->currentIndex());
     settings.setValue("ambientColor", colorPalette);
     settings.setValue("fullScreenChecked", fullscreenCheckBox->isChecked());
     settings.endGroup();
@@ -1,11 +1,13 @@
 #ifndef SIMSETTINGS_H
 #define SIMSETTINGS_H
+#include <algorithm>
 #include <parametermanager.h>
 #include <qt5/QtCore/QObject>
 #include <qt5/QtCore/QSettings>
 #include <qt5/QtCore/QString>
 #include <qt5/QtWidgets/QColorDialog>
 #include <qt5/QtWidgets/QCheckBox>
+#include <qt5/QtWidgets/QComboBox>
 #include <qt5/QtWidgets/QDialog>
 #include <qt5/QtWidgets/QDoubleSpinBox>
 #include <qt5/QtWidgets/QFormLayout>
@@ -15,6 +17,7 @@
 #include <qt5/QtWidgets/QLabel>
 #include <qt5/QtWidgets/QVBoxLayout>
 #include <qt5/QtWidgets/QWidget>
+#include <thread>
 
 class SettingsDialog : public QDialog {
     Q_OBJECT
@@ -28,8 +31,21 @@ private:
     QDoubleSpinBox *lightFractionSpin;
     QDoubleSpinBox *sunRadiusScaleSpin;
     QCheckBox *fullscreenCheckBox;
+    QComboBox *engineCombo;
+    QDoubleSpinBox *openingAngleSpin;
+    QCheckBox *quadrupoleCheckBox;
+    QSpinBox *expansionOrderSpin;
+    QComboBox *meshSizeCombo;
+    QCheckBox *shortRangeCheckBox;
+    QComboBox *integratorCombo;
+    QDoubleSpinBox *timeStepSpin;
+    QSpinBox *maxSubstepsSpin;
+    QDoubleSpinBox *timeStepAccuracySpin;
+    QComboBox *renderModeCombo;
     QSpinBox *randomSeedSpin;
     QSpinBox *countSpin;
+    QSpinBox *threadCountSpin;
+    QCheckBox *pinThreadsCheckBox;
     QPushButton* colorSelectButton;
     QColor colorPalette;
 
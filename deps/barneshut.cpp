@@ -0,0 +1,281 @@
+/**
+ * Octree construction and tree walk for the Barnes-Hut solver. Bodies are
+ *   never moved; the tree sorts an index array instead, so every node owns a
+ *   contiguous range of it and the walk visits bodies in spatial order.
+ */
+#include <barneshut.hpp>
+#include <algorithm>
+#include <cmath>
+#include <taskscheduler.hpp>
+
+// Deeper than this, coincident bodies are just left together in one leaf
+const int MAX_DEPTH = 32;
+
+BarnesHut::BarnesHut(float theta, bool quadrupole)
+{
+    BarnesHut::theta = std::max(theta, 0.0f);
+    BarnesHut::quadrupole = quadrupole;
+    leafSize = 8;
+    particles = ParticleView();
+}
+
+void BarnesHut::setTheta(float theta)
+{
+    BarnesHut::theta = std::max(theta, 0.0f);
+}
+
+void BarnesHut::setQuadrupole(bool enabled)
+{
+    quadrupole = enabled;
+}
+
+float BarnesHut::getTheta() const
+{
+    return theta;
+}
+
+bool BarnesHut::getQuadrupole() const
+{
+    return quadrupole;
+}
+
+size_t BarnesHut::getNodeCount() const
+{
+    return nodes.size();
+}
+
+/**
+ * Build the octree from scratch over the given bodies. The root is the
+ *   smallest cube containing every location.
+ */
+void BarnesHut::buildTree(const ParticleView& particles)
+{
+    BarnesHut::particles = particles;
+    const int N = particles.count;
+
+    nodes.clear();
+    order.resize(N);
+    scratch.resize(N);
+    for(int i = 0; i < N; i++) {
+        order[i] = i;
+    }
+
+    glm::vec3 lower(0.0f), upper(0.0f);
+    if(N > 0) {
+        lower = upper = particles.location(0);
+    }
+    for(int i = 1; i < N; i++) {
+        lower = glm::min(lower, particles.location(i));
+        upper = glm::max(upper, particles.location(i));
+    }
+    glm::vec3 extent = upper - lower;
+    float halfWidth = 0.5f * std::max(extent.x, std::max(extent.y, extent.z));
+
+    Node root;
+    root.center = 0.5f * (lower + upper);
+    // Pad slightly so bodies on the upper faces still land inside
+    root.halfWidth = halfWidth * 1.0001f + 1e-6f;
+    root.firstChild = -1;
+    root.begin = 0;
+    root.end = N;
+    nodes.push_back(root);
+
+    build(0, 0);
+    computeMoments(0);
+}
+
+/**
+ * Split a node's range of bodies into its eight octants with a counting
+ *   sort, then recurse into the non-empty children.
+ */
+void BarnesHut::build(int nodeIndex, int depth)
+{
+    const int begin = nodes[nodeIndex].begin;
+    const int end = nodes[nodeIndex].end;
+    if(end - begin <= leafSize || depth >= MAX_DEPTH) {
+        return;
+    }
+    const glm::vec3 center = nodes[nodeIndex].center;
+    const float childHalf = 0.5f * nodes[nodeIndex].halfWidth;
+
+    int counts[8] = {0};
+    for(int k = begin; k < end; k++) {
+        const glm::vec3 p = particles.location(order[k]);
+        int octant = (p.x >= center.x) | ((p.y >= center.y) << 1) | ((p.z >= center.z) << 2);
+        scratch[k] = octant;
+        counts[octant]++;
+    }
+    int offsets[8];
+    offsets[0] = begin;
+    for(int c = 1; c < 8; c++) {
+        offsets[c] = offsets[c - 1] + counts[c - 1];
+    }
+
+    // Children are appended after the parent's index is captured, since the
+    //   push_backs below may reallocate the node vector
+    const int firstChild = nodes.size();
+    nodes[nodeIndex].firstChild = firstChild;
+    for(int c = 0; c < 8; c++) {
+        Node child;
+        child.center = center + childHalf * glm::vec3(c & 1 ? 1 : -1, c & 2 ? 1 : -1, c & 4 ? 1 : -1);
+        child.halfWidth = childHalf;
+        child.firstChild = -1;
+        child.begin = offsets[c];
+        child.end = offsets[c] + counts[c];
+        nodes.push_back(child);
+    }
+
+    std::vector<int> sorted(end - begin);
+    for(int k = begin; k < end; k++) {
+        sorted[offsets[scratch[k]]++ - begin] = order[k];
+    }
+    std::copy(sorted.begin(), sorted.end(), order.begin() + begin);
+
+    for(int c = 0; c < 8; c++) {
+        if(nodes[firstChild + c].end > nodes[firstChild + c].begin) {
+            build(firstChild + c, depth + 1);
+        }
+    }
+}
+
+/**
+ * Post-order pass for mass, center of mass and the traceless quadrupole
+ *   Q = sum m (3 d d^T - |d|^2 I), shifted from children with the parallel
+ *   axis theorem.
+ */
+void BarnesHut::computeMoments(int nodeIndex)
+{
+    Node& node = nodes[nodeIndex];
+    float mass = 0.0f;
+    glm::vec3 weighted(0.0f);
+    std::fill(node.quad, node.quad + 6, 0.0f);
+
+    if(node.firstChild == -1) {
+        for(int k = node.begin; k < node.end; k++) {
+            mass += particles.mass[order[k]];
+            weighted += particles.mass[order[k]] * particles.location(order[k]);
+        }
+    }
+    else {
+        for(int c = 0; c < 8; c++) {
+            computeMoments(node.firstChild + c);
+            const Node& child = nodes[node.firstChild + c];
+            mass += child.mass;
+            weighted += child.mass * child.com;
+        }
+    }
+    node.mass = mass;
+    node.com = mass > 0.0f ? weighted / mass : node.center;
+    node.delta = glm::length(node.com - node.center);
+    if(!quadrupole || mass <= 0.0f) {
+        return;
+    }
+
+    auto addPoint = [&node](float m, const glm::vec3& d) {
+        float d2 = glm::dot(d, d);
+        node.quad[0] += m * (3.0f * d.x * d.x - d2);
+        node.quad[1] += m * (3.0f * d.x * d.y);
+        node.quad[2] += m * (3.0f * d.x * d.z);
+        node.quad[3] += m * (3.0f * d.y * d.y - d2);
+        node.quad[4] += m * (3.0f * d.y * d.z);
+        node.quad[5] += m * (3.0f * d.z * d.z - d2);
+    };
+    if(node.firstChild == -1) {
+        for(int k = node.begin; k < node.end; k++) {
+            addPoint(particles.mass[order[k]], particles.location(order[k]) - node.com);
+        }
+    }
+    else {
+        for(int c = 0; c < 8; c++) {
+            const Node& child = nodes[node.firstChild + c];
+            if(child.mass <= 0.0f) {
+                continue;
+            }
+            for(int q = 0; q < 6; q++) {
+                node.quad[q] += child.quad[q];
+            }
+            addPoint(child.mass, child.com - node.com);
+        }
+    }
+}
+
+/**
+ * Acceleration on a single body. A cell is accepted when its distance
+ *   exceeds size / theta + delta, where delta is the offset of the center of
+ *   mass from the cell center; this keeps bodies from ever accepting a cell
+ *   that contains them.
+ */
+glm::vec3 BarnesHut::walk(int body, float G) const
+{
+    glm::vec3 acc(0.0f);
+    const glm::vec3 x = particles.location(body);
+    int stack[8 * MAX_DEPTH + 8];
+    int top = 0;
+    stack[top++] = 0;
+    while(top > 0) {
+        const Node& node = nodes[stack[--top]];
+        if(node.mass <= 0.0f) {
+            continue;
+        }
+        if(node.firstChild == -1) {
+            for(int k = node.begin; k < node.end; k++) {
+                int j = order[k];
+                if(j == body) {
+                    continue;
+                }
+                glm::vec3 r = particles.location(j) - x;
+                float r2 = glm::dot(r, r);
+                if(r2 <= 0.0f) {
+                    continue;
+                }
+                float invR = 1.0f / std::sqrt(r2);
+                acc += G * particles.mass[j] * invR * invR * invR * r;
+            }
+            continue;
+        }
+        glm::vec3 R = x - node.com;
+        float R2 = glm::dot(R, R);
+        float openDistance = 2.0f * node.halfWidth / theta + node.delta;
+        if(theta > 0.0f && R2 > openDistance * openDistance) {
+            float invR = 1.0f / std::sqrt(R2);
+            float invR3 = invR * invR * invR;
+            // Monopole: -G M R / |R|^3
+            acc -= G * node.mass * invR3 * R;
+            if(quadrupole) {
+                // -grad of -G/2 (R.QR) / |R|^5
+                const float* q = node.quad;
+                glm::vec3 QR(q[0] * R.x + q[1] * R.y + q[2] * R.z,
+                             q[1] * R.x + q[3] * R.y + q[4] * R.z,
+                             q[2] * R.x + q[4] * R.y + q[5] * R.z);
+                float invR5 = invR3 * invR * invR;
+                acc += G * invR5 * (QR - 2.5f * glm::dot(R, QR) * invR * invR * R);
+            }
+            continue;
+        }
+        for(int c = 0; c < 8; c++) {
+            stack[top++] = node.firstChild + c;
+        }
+    }
+    return acc;
+}
+
+/**
+ * Rebuild the tree and walk it for every body. Bodies are handed out in
+ *   tree order, so each thread works on a spatially coherent block and
+ *   neighbouring walks share most of their nodes in cache.
+ */
+void BarnesHut::computeAccelerations(const ParticleView& particles, float G, AccelerationView accelerations,
+                                     unsigned nThreads)
+{
+    buildTree(particles);
+    const int N = particles.count;
+
+    auto walkRange = [this, G, accelerations](int begin, int end) mutable {
+        for(int k = begin; k < end; k++) {
+            accelerations.set(order[k], walk(order[k], G));
+        }
+    };
+    TaskScheduler::shared().parallelFor(0, N, stealingGrain(N, nThreads, 64), [&walkRange](size_t begin, size_t end) {
+        walkRange(begin, end);
+    });
+}
@@ -0,0 +1,55 @@
+#ifndef BARNES_HUT_HPP
+#define BARNES_HUT_HPP
+
+#include <glm/glm.hpp>
+#include <particlestore.hpp>
+#include <vector>
+
+/**
+ * Barnes-Hut octree gravity solver. The tree is rebuilt over the current
+ *   locations every step, and a cell is treated as a single multipole once
+ *   it is far enough away relative to the opening angle theta. Smaller theta
+ *   is more accurate and slower; theta = 0 degenerates to direct summation.
+*/
+class BarnesHut
+{
+    struct Node {
+        glm::vec3 center;   // geometric center of the cubic cell
+        float halfWidth;
+        glm::vec3 com;      // center of mass
+        float mass;
+        float delta;        // |com - center|, widens the opening test
+        float quad[6];      // traceless quadrupole: xx, xy, xz, yy, yz, zz
+        int firstChild;     // index of 8 contiguous children, -1 for a leaf
+        int begin, end;     // range of bodies in order
+    };
+
+    float theta;
+    bool quadrupole;
+    int leafSize;
+
+    std::vector<Node> nodes;
+    std::vector<int> order;
+    std::vector<int> scratch;
+
+    ParticleView particles;
+
+    void build(int nodeIndex, int depth);
+    void computeMoments(int nodeIndex);
+    glm::vec3 walk(int body, float G) const;
+
+public:
+    BarnesHut(float theta = 0.5f, bool quadrupole = false);
+
+    void setTheta(float theta);
+    void setQuadrupole(bool enabled);
+    float getTheta() const;
+    bool getQuadrupole() const;
+    size_t getNodeCount() const;
+
+    void buildTree(const ParticleView& particles);
+    void computeAccelerations(const ParticleView& particles, float G, AccelerationView accelerations,
+                              unsigned nThreads = 1);
+};
+
+#endif
@@ -0,0 +1,281 @@
+/**
+ * Direct summation kernels, one per instruction set. All of them walk the
+ *   j-particles tile by tile over the padded length of the arrays, so no
+ *   remainder loop is needed: padding lanes have zero mass and sit far away.
+ */
+#include <directkernel.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <taskscheduler.hpp>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DIRECT_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+SimdLevel detectSimdLevel()
+{
+#ifdef DIRECT_KERNEL_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) {
+        return SimdLevel::AVX512;
+    }
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return SimdLevel::AVX2;
+    }
+    if(__builtin_cpu_supports("sse2")) {
+        return SimdLevel::SSE;
+    }
+#endif
+    return SimdLevel::Scalar;
+}
+
+const char* simdLevelName(SimdLevel level)
+{
+    switch(level) {
+        case SimdLevel::AVX512:
+            return "AVX-512";
+        case SimdLevel::AVX2:
+            return "AVX2";
+        case SimdLevel::SSE:
+            return "SSE2";
+        default:
+            return "scalar";
+    }
+}
+
+/**
+ * Reference path. Same tiling and the same contact rule as the vector
+ *   kernels, so the only difference between levels is rounding.
+ */
+static bool rowsScalar(const ParticleView& p, float G, AccelerationView a, size_t begin, size_t end)
+{
+    bool contact = false;
+    for(size_t tile = 0; tile < p.paddedCount; tile += DIRECT_TILE_SIZE) {
+        const size_t tileEnd = std::min(tile + DIRECT_TILE_SIZE, p.paddedCount);
+        for(size_t i = begin; i < end; i++) {
+            float ax = 0.0f, ay = 0.0f, az = 0.0f;
+            for(size_t j = tile; j < tileEnd; j++) {
+                float dx = p.x[j] - p.x[i];
+                float dy = p.y[j] - p.y[i];
+                float dz = p.z[j] - p.z[i];
+                float r2 = dx * dx + dy * dy + dz * dz;
+                float s = p.radius[i] + p.radius[j];
+                if(r2 <= s * s) {
+                    contact = contact || r2 > 0.0f;
+                    continue;
+                }
+                float invR = 1.0f / std::sqrt(r2);
+                float w = p.mass[j] * invR * invR * invR;
+                ax += w * dx;
+                ay += w * dy;
+                az += w * dz;
+            }
+            a.x[i] += G * ax;
+            a.y[i] += G * ay;
+            a.z[i] += G * az;
+        }
+    }
+    return contact;
+}
+
+#ifdef DIRECT_KERNEL_X86
+
+__attribute__((target("sse2")))
+static float horizontalSum4(__m128 v)
+{
+    __m128 shuffled = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 sums = _mm_add_ps(v, shuffled);
+    shuffled = _mm_movehl_ps(shuffled, sums);
+    return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+}
+
+__attribute__((target("sse2")))
+static bool rowsSSE(const ParticleView& p, float G, AccelerationView a, size_t begin, size_t end)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 threeHalves = _mm_set1_ps(1.5f);
+    __m128 contact = zero;
+    for(size_t tile = 0; tile < p.paddedCount; tile += DIRECT_TILE_SIZE) {
+        const size_t tileEnd = std::min(tile + DIRECT_TILE_SIZE, p.paddedCount);
+        for(size_t i = begin; i < end; i++) {
+            const __m128 xi = _mm_set1_ps(p.x[i]);
+            const __m128 yi = _mm_set1_ps(p.y[i]);
+            const __m128 zi = _mm_set1_ps(p.z[i]);
+            const __m128 ri = _mm_set1_ps(p.radius[i]);
+            __m128 ax = zero, ay = zero, az = zero;
+            for(size_t j = tile; j < tileEnd; j += 4) {
+                __m128 dx = _mm_sub_ps(_mm_load_ps(p.x + j), xi);
+                __m128 dy = _mm_sub_ps(_mm_load_ps(p.y + j), yi);
+                __m128 dz = _mm_sub_ps(_mm_load_ps(p.z + j), zi);
+                __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                __m128 s = _mm_add_ps(_mm_load_ps(p.radius + j), ri);
+                __m128 apart = _mm_cmpgt_ps(r2, _mm_mul_ps(s, s));
+                contact = _mm_or_ps(contact, _mm_andnot_ps(apart, _mm_cmpgt_ps(r2, zero)));
+                // y' = y (3/2 - x y^2 / 2)
+                __m128 invR = _mm_rsqrt_ps(r2);
+                invR = _mm_mul_ps(invR, _mm_sub_ps(threeHalves, _mm_mul_ps(_mm_mul_ps(half, r2), _mm_mul_ps(invR, invR))));
+                __m128 w = _mm_mul_ps(_mm_mul_ps(invR, invR), _mm_mul_ps(invR, _mm_load_ps(p.mass + j)));
+                w = _mm_and_ps(w, apart);
+                ax = _mm_add_ps(ax, _mm_mul_ps(w, dx));
+                ay = _mm_add_ps(ay, _mm_mul_ps(w, dy));
+                az = _mm_add_ps(az, _mm_mul_ps(w, dz));
+            }
+            a.x[i] += G * horizontalSum4(ax);
+            a.y[i] += G * horizontalSum4(ay);
+            a.z[i] += G * horizontalSum4(az);
+        }
+    }
+    return _mm_movemask_ps(contact) != 0;
+}
+
+__attribute__((target("avx2,fma")))
+static float horizontalSum8(__m256 v)
+{
+    __m128 sums = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sums = _mm_add_ps(sums, _mm_movehl_ps(sums, sums));
+    sums = _mm_add_ss(sums, _mm_shuffle_ps(sums, sums, 1));
+    return _mm_cvtss_f32(sums);
+}
+
+__attribute__((target("avx2,fma")))
+static bool rowsAVX2(const ParticleView& p, float G, AccelerationView a, size_t begin, size_t end)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 threeHalves = _mm256_set1_ps(1.5f);
+    __m256 contact = zero;
+    for(size_t tile = 0; tile < p.paddedCount; tile += DIRECT_TILE_SIZE) {
+        const size_t tileEnd = std::min(tile + DIRECT_TILE_SIZE, p.paddedCount);
+        for(size_t i = begin; i < end; i++) {
+            const __m256 xi = _mm256_set1_ps(p.x[i]);
+            const __m256 yi = _mm256_set1_ps(p.y[i]);
+            const __m256 zi = _mm256_set1_ps(p.z[i]);
+            const __m256 ri = _mm256_set1_ps(p.radius[i]);
+            __m256 ax = zero, ay = zero, az = zero;
+            for(size_t j = tile; j < tileEnd; j += 8) {
+                __m256 dx = _mm256_sub_ps(_mm256_load_ps(p.x + j), xi);
+                __m256 dy = _mm256_sub_ps(_mm256_load_ps(p.y + j), yi);
+                __m256 dz = _mm256_sub_ps(_mm256_load_ps(p.z + j), zi);
+                __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+                __m256 s = _mm256_add_ps(_mm256_load_ps(p.radius + j), ri);
+                __m256 apart = _mm256_cmp_ps(r2, _mm256_mul_ps(s, s), _CMP_GT_OQ);
+                contact = _mm256_or_ps(contact, _mm256_andnot_ps(apart, _mm256_cmp_ps(r2, zero, _CMP_GT_OQ)));
+                __m256 invR = _mm256_rsqrt_ps(r2);
+                invR = _mm256_mul_ps(invR, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(invR, invR), threeHalves));
+                __m256 w = _mm256_mul_ps(_mm256_mul_ps(invR, invR), _mm256_mul_ps(invR, _mm256_load_ps(p.mass + j)));
+                w = _mm256_and_ps(w, apart);
+                ax = _mm256_fmadd_ps(w, dx, ax);
+                ay = _mm256_fmadd_ps(w, dy, ay);
+                az = _mm256_fmadd_ps(w, dz, az);
+            }
+            a.x[i] += G * horizontalSum8(ax);
+            a.y[i] += G * horizontalSum8(ay);
+            a.z[i] += G * horizontalSum8(az);
+        }
+    }
+    return _mm256_movemask_ps(contact) != 0;
+}
+
+__attribute__((target("avx512f")))
+static bool rowsAVX512(const ParticleView& p, float G, AccelerationView a, size_t begin, size_t end)
+{
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 threeHalves = _mm512_set1_ps(1.5f);
+    __mmask16 contact = 0;
+    for(size_t tile = 0; tile < p.paddedCount; tile += DIRECT_TILE_SIZE) {
+        const size_t tileEnd = std::min(tile + DIRECT_TILE_SIZE, p.paddedCount);
+        for(size_t i = begin; i < end; i++) {
+            const __m512 xi = _mm512_set1_ps(p.x[i]);
+            const __m512 yi = _mm512_set1_ps(p.y[i]);
+            const __m512 zi = _mm512_set1_ps(p.z[i]);
+            const __m512 ri = _mm512_set1_ps(p.radius[i]);
+            __m512 ax = zero, ay = zero, az = zero;
+            for(size_t j = tile; j < tileEnd; j += 16) {
+                __m512 dx = _mm512_sub_ps(_mm512_load_ps(p.x + j), xi);
+                __m512 dy = _mm512_sub_ps(_mm512_load_ps(p.y + j), yi);
+                __m512 dz = _mm512_sub_ps(_mm512_load_ps(p.z + j), zi);
+                __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+                __m512 s = _mm512_add_ps(_mm512_load_ps(p.radius + j), ri);
+                __mmask16 apart = _mm512_cmp_ps_mask(r2, _mm512_mul_ps(s, s), _CMP_GT_OQ);
+                contact |= _mm512_mask_cmp_ps_mask((__mmask16) ~apart, r2, zero, _CMP_GT_OQ);
+                // rsqrt14 is already accurate to 14 bits, one step brings it to ~23
+                __m512 invR = _mm512_rsqrt14_ps(r2);
+                invR = _mm512_mul_ps(invR, _mm512_fnmadd_ps(_mm512_mul_ps(half, r2), _mm512_mul_ps(invR, invR), threeHalves));
+                __m512 w = _mm512_mul_ps(_mm512_mul_ps(invR, invR), _mm512_mul_ps(invR, _mm512_load_ps(p.mass + j)));
+                ax = _mm512_mask3_fmadd_ps(w, dx, ax, apart);
+                ay = _mm512_mask3_fmadd_ps(w, dy, ay, apart);
+                az = _mm512_mask3_fmadd_ps(w, dz, az, apart);
+            }
+            a.x[i] += G * _mm512_reduce_add_ps(ax);
+            a.y[i] += G * _mm512_reduce_add_ps(ay);
+            a.z[i] += G * _mm512_reduce_add_ps(az);
+        }
+    }
+    return contact != 0;
+}
+
+#endif
+
+DirectKernel::DirectKernel()
+{
+    level = detectSimdLevel();
+}
+
+/**
+ * Force a lower instruction set, e.g. to compare against the scalar path.
+ *   Anything the CPU cannot run is clamped to what it can.
+ */
+void DirectKernel::setLevel(SimdLevel level)
+{
+    DirectKernel::level = std::min(level, detectSimdLevel());
+}
+
+SimdLevel DirectKernel::getLevel() const
+{
+    return level;
+}
+
+/**
+ * Full rows rather than the symmetric upper triangle: twice the
+ *   interactions, but no scattered writes to j, so the inner loop is pure
+ *   loads and every thread owns its rows outright. Returns true if any two
+ *   spheres overlap.
+ */
+bool DirectKernel::computeAccelerations(const ParticleView& particles, float G, AccelerationView accelerations,
+                                        unsigned nThreads) const
+{
+    const size_t N = particles.count;
+    std::fill(accelerations.x, accelerations.x + N, 0.0f);
+    std::fill(accelerations.y, accelerations.y + N, 0.0f);
+    std::fill(accelerations.z, accelerations.z + N, 0.0f);
+
+    auto rows = rowsScalar;
+#ifdef DIRECT_KERNEL_X86
+    switch(level) {
+        case SimdLevel::AVX512:
+            rows = rowsAVX512;
+            break;
+        case SimdLevel::AVX2:
+            rows = rowsAVX2;
+            break;
+        case SimdLevel::SSE:
+            rows = rowsSSE;
+            break;
+        default:
+            break;
+    }
+#endif
+
+    std::atomic<bool> contacts(false);
+    TaskScheduler::shared().parallelFor(0, N, stealingGrain(N, nThreads, 64), [&](size_t begin, size_t end) {
+        if(rows(particles, G, accelerations, begin, end)) {
+            contacts = true;
+        }
+    });
+    return contacts.load();
+}
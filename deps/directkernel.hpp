@@ -0,0 +1,37 @@
+#ifndef DIRECT_KERNEL_HPP
+#define DIRECT_KERNEL_HPP
+
+#include <particlestore.hpp>
+
+// j-particles per tile: x, y, z, mass and radius for 512 bodies is 10 KiB,
+//   which stays resident in L1 while every i-particle streams past it
+const size_t DIRECT_TILE_SIZE = 512;
+
+enum class SimdLevel { Scalar = 0, SSE, AVX2, AVX512 };
+
+SimdLevel detectSimdLevel();
+const char* simdLevelName(SimdLevel level);
+
+/**
+ * Vectorized direct summation. Each i-particle is broadcast against a tile
+ *   of j-particles 4, 8 or 16 at a time, with 1/r from rsqrt plus one Newton
+ *   step. The instruction set is chosen once at runtime from CPUID, so the
+ *   binary itself does not need to be built for AVX. Pairs whose spheres
+ *   overlap exert no force and are reported back instead, matching the
+ *   serial loop that merges them.
+*/
+class DirectKernel
+{
+    SimdLevel level;
+
+public:
+    DirectKernel();
+
+    void setLevel(SimdLevel level);
+    SimdLevel getLevel() const;
+
+    bool computeAccelerations(const ParticleView& particles, float G, AccelerationView accelerations,
+                              unsigned nThreads = 1) const;
+};
+
+#endif
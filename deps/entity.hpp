@@ -38,17 +38,39 @@ public:
 };
 
 
+// Rings (and sectors) of each level of detail, finest first
+const GLuint SPHERE_LOD_COUNT = 5;
+const GLuint SPHERE_LOD_RESOLUTIONS[SPHERE_LOD_COUNT] = { 80, 40, 20, 10, 6 };
+
+/**
+ * Where one level of detail sits in the sphere's shared index list
+*/
+struct SphereLod
+{
+    GLuint resolution;
+    GLuint firstIndex;
+    GLuint indexCount;
+};
+
+/**
+ * A UV sphere at every level of detail, all in the one vertex and index
+ *   list; the indices of each level already point at its own vertices.
+*/
 class Sphere: public Entity
 {
 private:
     float radius;
     GLuint rings, sectors;
+    std::vector<SphereLod> lods;
     void createVertices() override;
     void createIndices() override;
+    void createLods();
     glm::vec3 color;
 
 public:
     Sphere(float radius, const glm::vec3& color);
     Sphere();
+
+    const std::vector<SphereLod>& getLods() const;
 };
 #endif
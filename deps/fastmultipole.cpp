@@ -0,0 +1,559 @@
+/**
+ * Cartesian FMM. With Taylor coefficients a_k(R) = D^k(1/|R|) / k!, the
+ *   potential of a cell with moments M_k = sum m (x - c)^k at a point y is
+ *
+ *     phi(y) = -sum_k (-1)^|k| M_k a_k(y - c),
+ *
+ *   and shifting a_k to a local center gives the multipole-to-local
+ *   translation L_j = -sum_k (-1)^|k| M_k C(k + j, j) a_{k + j}(R). The
+ *   a_k follow from a three-term recurrence, so any order is available
+ *   without hand-written kernels. G is applied once at the very end.
+ */
+#include <fastmultipole.hpp>
+#include <algorithm>
+#include <cmath>
+#include <taskscheduler.hpp>
+
+const int FMM_MAX_DEPTH = 32;
+const int FMM_MAX_ORDER = 10;
+const int FMM_TERM_CAPACITY = (FMM_MAX_ORDER + 1) * (FMM_MAX_ORDER + 2) * (FMM_MAX_ORDER + 3) / 6;
+
+FastMultipole::FastMultipole(int order, float theta)
+{
+    leafSize = 64;
+    particles = ParticleView();
+    FastMultipole::theta = std::max(theta, 0.0f);
+    setOrder(order);
+}
+
+void FastMultipole::setOrder(int order)
+{
+    // Order 0 carries no force, so 1 (monopole + gradient) is the minimum
+    FastMultipole::order = std::max(1, std::min(order, FMM_MAX_ORDER));
+    buildTables();
+}
+
+void FastMultipole::setTheta(float theta)
+{
+    FastMultipole::theta = std::max(theta, 0.0f);
+}
+
+int FastMultipole::getOrder() const
+{
+    return order;
+}
+
+float FastMultipole::getTheta() const
+{
+    return theta;
+}
+
+int FastMultipole::coefficientCount() const
+{
+    return powers.size();
+}
+
+int FastMultipole::index(int a, int b, int c) const
+{
+    return powerIndex[(a * (order + 1) + b) * (order + 1) + c];
+}
+
+double FastMultipole::binomial(int n, int k) const
+{
+    return binomials[n * (order + 1) + k];
+}
+
+/**
+ * Multi-indices are stored by increasing total degree, which is the order
+ *   the derivative recurrence needs them in.
+ */
+void FastMultipole::buildTables()
+{
+    const int P = order + 1;
+    powers.clear();
+    powerIndex.assign(P * P * P, -1);
+    for(int n = 0; n <= order; n++) {
+        for(int a = n; a >= 0; a--) {
+            for(int b = n - a; b >= 0; b--) {
+                int c = n - a - b;
+                powerIndex[(a * P + b) * P + c] = powers.size();
+                powers.push_back(glm::ivec3(a, b, c));
+            }
+        }
+    }
+    binomials.assign(P * P, 0.0);
+    for(int n = 0; n <= order; n++) {
+        binomials[n * P] = 1.0;
+        for(int k = 1; k <= n; k++) {
+            binomials[n * P + k] = binomials[(n - 1) * P + k - 1] + (k < n ? binomials[(n - 1) * P + k] : 0.0);
+        }
+    }
+
+    // Flatten the translations so the hot loops are a single pass over
+    //   precomputed products instead of nested multi-index loops
+    shiftTerms.clear();
+    localTerms.clear();
+    paritySigns.clear();
+    for(int qk = 0; qk < coefficientCount(); qk++) {
+        const glm::ivec3& k = powers[qk];
+        for(int qj = 0; qj < coefficientCount(); qj++) {
+            const glm::ivec3& j = powers[qj];
+            if(j.x <= k.x && j.y <= k.y && j.z <= k.z) {
+                Term term;
+                term.out = qk;
+                term.in = qj;
+                term.shift = index(k.x - j.x, k.y - j.y, k.z - j.z);
+                term.coef = binomial(k.x, j.x) * binomial(k.y, j.y) * binomial(k.z, j.z);
+                shiftTerms.push_back(term);
+            }
+        }
+    }
+    for(int qj = 0; qj < coefficientCount(); qj++) {
+        const glm::ivec3& j = powers[qj];
+        const int nj = j.x + j.y + j.z;
+        paritySigns.push_back(nj & 1 ? -1.0 : 1.0);
+        for(int qk = 0; qk < coefficientCount(); qk++) {
+            const glm::ivec3& k = powers[qk];
+            const int nk = k.x + k.y + k.z;
+            if(nk + nj > order) {
+                break;
+            }
+            Term term;
+            term.out = qj;
+            term.in = qk;
+            term.shift = index(k.x + j.x, k.y + j.y, k.z + j.z);
+            term.coef = binomial(k.x + j.x, j.x) * binomial(k.y + j.y, j.y) * binomial(k.z + j.z, j.z);
+            localTerms.push_back(term);
+        }
+    }
+}
+
+/**
+ * All monomials d^k for |k| <= order
+ */
+void FastMultipole::shiftPowers(const glm::dvec3& d, double* dk) const
+{
+    double px[FMM_MAX_ORDER + 1], py[FMM_MAX_ORDER + 1], pz[FMM_MAX_ORDER + 1];
+    px[0] = py[0] = pz[0] = 1.0;
+    for(int n = 1; n <= order; n++) {
+        px[n] = px[n - 1] * d.x;
+        py[n] = py[n - 1] * d.y;
+        pz[n] = pz[n - 1] * d.z;
+    }
+    for(int q = 0; q < coefficientCount(); q++) {
+        dk[q] = px[powers[q].x] * py[powers[q].y] * pz[powers[q].z];
+    }
+}
+
+void FastMultipole::build(int cellIndex, int depth)
+{
+    const int begin = cells[cellIndex].begin;
+    const int end = cells[cellIndex].end;
+    if(end - begin <= leafSize || depth >= FMM_MAX_DEPTH) {
+        leaves.push_back(cellIndex);
+        return;
+    }
+    const glm::dvec3 center = cells[cellIndex].center;
+    const double childHalf = 0.5 * cells[cellIndex].halfWidth;
+
+    int counts[8] = {0};
+    std::vector<int> octants(end - begin);
+    for(int k = begin; k < end; k++) {
+        const glm::vec3 p = particles.location(bodyOrder[k]);
+        int octant = (p.x >= center.x) | ((p.y >= center.y) << 1) | ((p.z >= center.z) << 2);
+        octants[k - begin] = octant;
+        counts[octant]++;
+    }
+    int offsets[8];
+    offsets[0] = begin;
+    for(int c = 1; c < 8; c++) {
+        offsets[c] = offsets[c - 1] + counts[c - 1];
+    }
+
+    const int firstChild = cells.size();
+    cells[cellIndex].firstChild = firstChild;
+    for(int c = 0; c < 8; c++) {
+        Cell child;
+        child.center = center + childHalf * glm::dvec3(c & 1 ? 1 : -1, c & 2 ? 1 : -1, c & 4 ? 1 : -1);
+        child.halfWidth = childHalf;
+        child.firstChild = -1;
+        child.begin = offsets[c];
+        child.end = offsets[c] + counts[c];
+        child.mass = 0.0;
+        cells.push_back(child);
+    }
+
+    std::vector<int> sorted(end - begin);
+    for(int k = begin; k < end; k++) {
+        sorted[offsets[octants[k - begin]]++ - begin] = bodyOrder[k];
+    }
+    std::copy(sorted.begin(), sorted.end(), bodyOrder.begin() + begin);
+
+    for(int c = 0; c < 8; c++) {
+        if(cells[firstChild + c].end > cells[firstChild + c].begin) {
+            build(firstChild + c, depth + 1);
+        }
+    }
+}
+
+/**
+ * P2M for one leaf, including its mass, center of mass and radius
+ */
+void FastMultipole::particleToMultipole(int cellIndex)
+{
+    Cell& cell = cells[cellIndex];
+    double mass = 0.0;
+    glm::dvec3 weighted(0.0);
+    for(int k = cell.begin; k < cell.end; k++) {
+        mass += particles.mass[bodyOrder[k]];
+        weighted += (double) particles.mass[bodyOrder[k]] * glm::dvec3(particles.location(bodyOrder[k]));
+    }
+    cell.mass = mass;
+    cell.com = mass > 0.0 ? weighted / mass : cell.center;
+    cell.radius = 0.0;
+
+    double* M = &multipoles[cellIndex * coefficientCount()];
+    std::fill(M, M + coefficientCount(), 0.0);
+    double dk[FMM_TERM_CAPACITY];
+    for(int k = cell.begin; k < cell.end; k++) {
+        glm::dvec3 d = glm::dvec3(particles.location(bodyOrder[k])) - cell.com;
+        cell.radius = std::max(cell.radius, glm::length(d));
+        shiftPowers(d, dk);
+        double m = particles.mass[bodyOrder[k]];
+        for(int q = 0; q < coefficientCount(); q++) {
+            M[q] += m * dk[q];
+        }
+    }
+}
+
+/**
+ * M2M: M_k(parent) = sum_{j <= k} C(k, j) M_j(child) d^(k - j)
+ */
+void FastMultipole::upward(int cellIndex)
+{
+    if(cells[cellIndex].firstChild == -1) {
+        return;
+    }
+    const int firstChild = cells[cellIndex].firstChild;
+    double mass = 0.0;
+    glm::dvec3 weighted(0.0);
+    for(int c = firstChild; c < firstChild + 8; c++) {
+        if(cells[c].end == cells[c].begin) {
+            continue;
+        }
+        upward(c);
+        mass += cells[c].mass;
+        weighted += cells[c].mass * cells[c].com;
+    }
+    Cell& cell = cells[cellIndex];
+    cell.mass = mass;
+    cell.com = mass > 0.0 ? weighted / mass : cell.center;
+    cell.radius = 0.0;
+
+    double* M = &multipoles[cellIndex * coefficientCount()];
+    std::fill(M, M + coefficientCount(), 0.0);
+    double dk[FMM_TERM_CAPACITY];
+    for(int c = firstChild; c < firstChild + 8; c++) {
+        if(cells[c].end == cells[c].begin) {
+            continue;
+        }
+        const double* childM = &multipoles[c * coefficientCount()];
+        glm::dvec3 d = cells[c].com - cell.com;
+        cell.radius = std::max(cell.radius, glm::length(d) + cells[c].radius);
+        shiftPowers(d, dk);
+        for(const Term& term : shiftTerms) {
+            M[term.out] += term.coef * childM[term.in] * dk[term.shift];
+        }
+    }
+}
+
+/**
+ * Taylor coefficients of 1/|R| through the recurrence
+ *   n |R|^2 a_k + (2n - 1) sum_i R_i a_{k - e_i} + (n - 1) sum_i a_{k - 2 e_i} = 0
+ */
+void FastMultipole::derivatives(const glm::dvec3& R, double* a) const
+{
+    const double r2 = glm::dot(R, R);
+    a[0] = 1.0 / std::sqrt(r2);
+    for(int q = 1; q < coefficientCount(); q++) {
+        const glm::ivec3& k = powers[q];
+        const int n = k.x + k.y + k.z;
+        double first = 0.0, second = 0.0;
+        if(k.x > 0) first += R.x * a[index(k.x - 1, k.y, k.z)];
+        if(k.y > 0) first += R.y * a[index(k.x, k.y - 1, k.z)];
+        if(k.z > 0) first += R.z * a[index(k.x, k.y, k.z - 1)];
+        if(k.x > 1) second += a[index(k.x - 2, k.y, k.z)];
+        if(k.y > 1) second += a[index(k.x, k.y - 2, k.z)];
+        if(k.z > 1) second += a[index(k.x, k.y, k.z - 2)];
+        a[q] = -((2 * n - 1) * first + (n - 1) * second) / (n * r2);
+    }
+}
+
+/**
+ * Both directions of an M2L share the same coefficients, since
+ *   a_k(-R) = (-1)^|k| a_k(R).
+ */
+void FastMultipole::multipoleToLocalMutual(int A, int B)
+{
+    double a[FMM_TERM_CAPACITY];
+    derivatives(cells[A].com - cells[B].com, a);
+    const double* MA = &multipoles[A * coefficientCount()];
+    const double* MB = &multipoles[B * coefficientCount()];
+    double* LA = &locals[A * coefficientCount()];
+    double* LB = &locals[B * coefficientCount()];
+    // A sees B's moments with (-1)^|k|; B sees A's through a_k(-R), which
+    //   turns into (-1)^|j| on the output instead
+    double signedMB[FMM_TERM_CAPACITY];
+    double sumA[FMM_TERM_CAPACITY] = {0.0}, sumB[FMM_TERM_CAPACITY] = {0.0};
+    for(int q = 0; q < coefficientCount(); q++) {
+        signedMB[q] = paritySigns[q] * MB[q];
+    }
+    for(const Term& term : localTerms) {
+        double t = term.coef * a[term.shift];
+        sumA[term.out] += signedMB[term.in] * t;
+        sumB[term.out] += MA[term.in] * t;
+    }
+    for(int q = 0; q < coefficientCount(); q++) {
+        LA[q] -= sumA[q];
+        LB[q] -= paritySigns[q] * sumB[q];
+    }
+}
+
+void FastMultipole::particleToParticle(int A, int B)
+{
+    for(int p = cells[A].begin; p < cells[A].end; p++) {
+        const int i = bodyOrder[p];
+        glm::vec3 acc(0.0f);
+        for(int q = cells[B].begin; q < cells[B].end; q++) {
+            const int j = bodyOrder[q];
+            glm::vec3 r = particles.location(j) - particles.location(i);
+            float r2 = glm::dot(r, r);
+            if(r2 <= 0.0f) {
+                continue;
+            }
+            float invR = 1.0f / std::sqrt(r2);
+            glm::vec3 f = invR * invR * invR * r;
+            acc += particles.mass[j] * f;
+            nearField[j] -= particles.mass[i] * f;
+        }
+        nearField[i] += acc;
+    }
+}
+
+void FastMultipole::particleToParticleSelf(int A)
+{
+    for(int p = cells[A].begin; p < cells[A].end; p++) {
+        const int i = bodyOrder[p];
+        for(int q = p + 1; q < cells[A].end; q++) {
+            const int j = bodyOrder[q];
+            glm::vec3 r = particles.location(j) - particles.location(i);
+            float r2 = glm::dot(r, r);
+            if(r2 <= 0.0f) {
+                continue;
+            }
+            float invR = 1.0f / std::sqrt(r2);
+            glm::vec3 f = invR * invR * invR * r;
+            nearField[i] += particles.mass[j] * f;
+            nearField[j] -= particles.mass[i] * f;
+        }
+    }
+}
+
+/**
+ * Dual tree traversal. Well-separated pairs become one mutual M2L, pairs of
+ *   leaves are summed directly, and otherwise the larger cell is split.
+ */
+void FastMultipole::interactMutual(int A, int B)
+{
+    const Cell& a = cells[A];
+    const Cell& b = cells[B];
+    double distance = glm::length(a.com - b.com);
+    if(a.radius + b.radius < theta * distance) {
+        multipoleToLocalMutual(A, B);
+        return;
+    }
+    const bool leafA = a.firstChild == -1, leafB = b.firstChild == -1;
+    if(leafA && leafB) {
+        particleToParticle(A, B);
+        return;
+    }
+    if(leafB || (!leafA && a.radius >= b.radius)) {
+        for(int c = a.firstChild; c < a.firstChild + 8; c++) {
+            if(cells[c].end > cells[c].begin) {
+                interactMutual(c, B);
+            }
+        }
+    }
+    else {
+        for(int c = b.firstChild; c < b.firstChild + 8; c++) {
+            if(cells[c].end > cells[c].begin) {
+                interactMutual(A, c);
+            }
+        }
+    }
+}
+
+void FastMultipole::interactSelf(int A)
+{
+    const int firstChild = cells[A].firstChild;
+    if(firstChild == -1) {
+        particleToParticleSelf(A);
+        return;
+    }
+    for(int c = firstChild; c < firstChild + 8; c++) {
+        if(cells[c].end == cells[c].begin) {
+            continue;
+        }
+        interactSelf(c);
+        for(int d = c + 1; d < firstChild + 8; d++) {
+            if(cells[d].end > cells[d].begin) {
+                interactMutual(c, d);
+            }
+        }
+    }
+}
+
+/**
+ * L2L: L_j(child) = sum_{k >= j} C(k, j) L_k(parent) d^(k - j)
+ */
+void FastMultipole::downward(int cellIndex)
+{
+    const int firstChild = cells[cellIndex].firstChild;
+    if(firstChild == -1) {
+        return;
+    }
+    const double* L = &locals[cellIndex * coefficientCount()];
+    double dk[FMM_TERM_CAPACITY];
+    for(int c = firstChild; c < firstChild + 8; c++) {
+        if(cells[c].end == cells[c].begin) {
+            continue;
+        }
+        double* childL = &locals[c * coefficientCount()];
+        shiftPowers(cells[c].com - cells[cellIndex].com, dk);
+        for(const Term& term : shiftTerms) {
+            childL[term.in] += term.coef * L[term.out] * dk[term.shift];
+        }
+        downward(c);
+    }
+}
+
+/**
+ * L2P: the far-field acceleration is -grad sum_k L_k h^k
+ */
+void FastMultipole::localToParticle(int cellIndex)
+{
+    const double* L = &locals[cellIndex * coefficientCount()];
+    double px[FMM_MAX_ORDER + 1], py[FMM_MAX_ORDER + 1], pz[FMM_MAX_ORDER + 1];
+    for(int p = cells[cellIndex].begin; p < cells[cellIndex].end; p++) {
+        const int i = bodyOrder[p];
+        glm::dvec3 h = glm::dvec3(particles.location(i)) - cells[cellIndex].com;
+        px[0] = py[0] = pz[0] = 1.0;
+        for(int n = 1; n <= order; n++) {
+            px[n] = px[n - 1] * h.x;
+            py[n] = py[n - 1] * h.y;
+            pz[n] = pz[n - 1] * h.z;
+        }
+        glm::dvec3 gradient(0.0);
+        for(int q = 1; q < coefficientCount(); q++) {
+            const glm::ivec3& k = powers[q];
+            if(k.x > 0) gradient.x += L[q] * k.x * px[k.x - 1] * py[k.y] * pz[k.z];
+            if(k.y > 0) gradient.y += L[q] * k.y * px[k.x] * py[k.y - 1] * pz[k.z];
+            if(k.z > 0) gradient.z += L[q] * k.z * px[k.x] * py[k.y] * pz[k.z - 1];
+        }
+        farField[i] = glm::vec3(-gradient);
+    }
+}
+
+/**
+ * Build, upward pass, dual traversal, downward pass. The leaf-level P2M and
+ *   L2P stages are independent per leaf and are split over nThreads; the
+ *   traversal itself is serial, since every mutual interaction writes to
+ *   both cells.
+ */
+void FastMultipole::computeAccelerations(const ParticleView& particles, float G, AccelerationView accelerations,
+                                         unsigned nThreads)
+{
+    FastMultipole::particles = particles;
+    const int N = particles.count;
+    if(N == 0) {
+        return;
+    }
+
+    bodyOrder.resize(N);
+    for(int i = 0; i < N; i++) {
+        bodyOrder[i] = i;
+    }
+    glm::vec3 lower = particles.location(0), upper = particles.location(0);
+    for(int i = 1; i < N; i++) {
+        lower = glm::min(lower, particles.location(i));
+        upper = glm::max(upper, particles.location(i));
+    }
+    glm::vec3 extent = upper - lower;
+    Cell root;
+    root.center = 0.5 * (glm::dvec3(lower) + glm::dvec3(upper));
+    root.halfWidth = 0.5 * std::max(extent.x, std::max(extent.y, extent.z)) * 1.0001 + 1e-6;
+    root.firstChild = -1;
+    root.begin = 0;
+    root.end = N;
+    root.mass = 0.0;
+    cells.assign(1, root);
+    leaves.clear();
+    build(0, 0);
+
+    multipoles.assign(cells.size() * coefficientCount(), 0.0);
+    locals.assign(cells.size() * coefficientCount(), 0.0);
+    farField.assign(N, glm::vec3(0.0f));
+    nearField.assign(N, glm::vec3(0.0f));
+
+    auto overLeaves = [this, nThreads](void (FastMultipole::*stage)(int)) {
+        TaskScheduler::shared().parallelFor(0, leaves.size(), stealingGrain(leaves.size(), nThreads, 16),
+                                            [this, stage](size_t begin, size_t end) {
+            for(size_t l = begin; l < end; l++) {
+                (this->*stage)(leaves[l]);
+            }
+        });
+    };
+
+    overLeaves(&FastMultipole::particleToMultipole);
+    upward(0);
+    interactSelf(0);
+    downward(0);
+    overLeaves(&FastMultipole::localToParticle);
+
+    for(int i = 0; i < N; i++) {
+        accelerations.set(i, G * (farField[i] + nearField[i]));
+    }
+}
+
+float FastMultipole::measureError(const ParticleView& particles, float G, const AccelerationView& accelerations,
+                                  int samples)
+{
+    const int N = particles.count;
+    if(N < 2 || samples <= 0) {
+        return 0.0f;
+    }
+    const int stride = std::max(N / samples, 1);
+    const size_t sampleCount = (N + stride - 1) / stride;
+    // (squared error, squared norm) summed over the samples
+    glm::dvec2 sums = TaskScheduler::shared().parallelReduce(0, sampleCount, 4, glm::dvec2(0.0),
+        [&](size_t begin, size_t end) {
+            glm::dvec2 partial(0.0);
+            for(size_t s = begin; s < end; s++) {
+                const int i = s * stride;
+                glm::dvec3 exact(0.0);
+                for(int j = 0; j < N; j++) {
+                    glm::dvec3 r = glm::dvec3(particles.location(j)) - glm::dvec3(particles.location(i));
+                    double r2 = glm::dot(r, r);
+                    if(j == i || r2 <= 0.0) {
+                        continue;
+                    }
+                    exact += (double) G * particles.mass[j] / (r2 * std::sqrt(r2)) * r;
+                }
+                glm::dvec3 diff = glm::dvec3(accelerations.get(i)) - exact;
+                partial += glm::dvec2(glm::dot(diff, diff), glm::dot(exact, exact));
+            }
+            return partial;
+        },
+        [](const glm::dvec2& a, const glm::dvec2& b) { return a + b; });
+    return sums.y > 0.0 ? (float) std::sqrt(sums.x / sums.y) : 0.0f;
+}
@@ -0,0 +1,89 @@
+#ifndef FAST_MULTIPOLE_HPP
+#define FAST_MULTIPOLE_HPP
+
+#include <glm/glm.hpp>
+#include <particlestore.hpp>
+#include <vector>
+
+/**
+ * Fast Multipole Method gravity solver using Cartesian Taylor expansions of
+ *   1/r up to a configurable order p. Cells of an octree carry multipole
+ *   moments about their center of mass; a dual tree traversal turns every
+ *   well-separated pair of cells into a mutual multipole-to-local
+ *   translation, so each far-field interaction is evaluated once for both
+ *   sides. The local expansions are pushed down to the bodies at the end.
+*/
+class FastMultipole
+{
+    // One product of a flattened translation, out += coef * in * other[shift]
+    struct Term {
+        int out, in, shift;
+        double coef;
+    };
+
+    struct Cell {
+        glm::dvec3 center;  // geometric center of the cubic cell
+        double halfWidth;
+        glm::dvec3 com;     // expansion center
+        double radius;      // bound on |x - com| over the cell's bodies
+        double mass;
+        int firstChild;     // index of 8 contiguous children, -1 for a leaf
+        int begin, end;     // range of bodies in order
+    };
+
+    int order;
+    float theta;
+    int leafSize;
+
+    // Multi-index tables for all (a, b, c) with a + b + c <= order
+    std::vector<glm::ivec3> powers;
+    std::vector<int> powerIndex;
+    std::vector<double> binomials;
+    std::vector<Term> shiftTerms;    // M2M and L2L: k >= j, C(k, j) d^(k - j)
+    std::vector<Term> localTerms;    // M2L: j + k <= order, C(k + j, j) a_{k + j}
+    std::vector<double> paritySigns; // (-1)^|k|
+
+    std::vector<Cell> cells;
+    std::vector<double> multipoles;
+    std::vector<double> locals;
+    std::vector<int> bodyOrder;
+    std::vector<int> leaves;
+    std::vector<glm::vec3> farField;
+    std::vector<glm::vec3> nearField;
+
+    ParticleView particles;
+
+    int coefficientCount() const;
+    int index(int a, int b, int c) const;
+    double binomial(int n, int k) const;
+    void buildTables();
+    void build(int cellIndex, int depth);
+    void upward(int cellIndex);
+    void downward(int cellIndex);
+    void derivatives(const glm::dvec3& R, double* a) const;
+    void shiftPowers(const glm::dvec3& d, double* dk) const;
+    void interactMutual(int A, int B);
+    void interactSelf(int A);
+    void multipoleToLocalMutual(int A, int B);
+    void particleToParticle(int A, int B);
+    void particleToParticleSelf(int A);
+    void particleToMultipole(int cellIndex);
+    void localToParticle(int cellIndex);
+
+public:
+    FastMultipole(int order = 4, float theta = 0.5f);
+
+    void setOrder(int order);
+    void setTheta(float theta);
+    int getOrder() const;
+    float getTheta() const;
+
+    void computeAccelerations(const ParticleView& particles, float G, AccelerationView accelerations,
+                              unsigned nThreads = 1);
+
+    // RMS force error relative to direct summation over a sample of bodies
+    static float measureError(const ParticleView& particles, float G, const AccelerationView& accelerations,
+                              int samples);
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include <framegraph.hpp>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+// How long the main thread sleeps when there is nothing it can run
+const std::chrono::microseconds IDLE_WAIT(200);
+
+bool StageEvent::isDone()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return done;
+}
+
+void StageEvent::signal()
+{
+    std::vector<std::coroutine_handle<>> ready;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        done = true;
+        ready.swap(waiters);
+    }
+    for(std::coroutine_handle<> waiter : ready) {
+        waiter.resume();
+    }
+}
+
+// Returning false resumes the waiter straight away
+bool StageEvent::registerWaiter(std::coroutine_handle<> waiter)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if(done) {
+        return false;
+    }
+    waiters.push_back(waiter);
+    return true;
+}
+
+FrameGraph::Frame::~Frame()
+{
+    for(auto coroutine : coroutines) {
+        coroutine.destroy();
+    }
+}
+
+bool FrameGraph::Frame::isDone() const
+{
+    for(const auto& event : finished) {
+        if(!event->isDone()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Main-thread stages always go through the queue, even when already on the
+//   main thread, so the order they run in is the queue's to pick
+bool FrameGraph::ResumeOn::await_ready() const
+{
+    return false;
+}
+
+void FrameGraph::ResumeOn::await_suspend(std::coroutine_handle<> coroutine)
+{
+    if(thread == FrameThread::Worker) {
+        graph->scheduler.spawn(graph->workerTasks, [coroutine]() { coroutine.resume(); });
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(graph->mainLock);
+        graph->mainQueue.push_back(MainStage{stage, frame, coroutine});
+    }
+    graph->mainReady.notify_one();
+}
+
+FrameGraph::FrameGraph(TaskScheduler& scheduler) : scheduler(scheduler)
+{
+    mainThread = std::this_thread::get_id();
+    frameCount = 0;
+}
+
+FrameGraph::~FrameGraph()
+{
+    finish();
+}
+
+void FrameGraph::addResource(const std::string& name, unsigned copies)
+{
+    resources.push_back(Resource{name, std::max(copies, 1u)});
+    hazards.push_back(std::vector<Hazard>(resources.back().copies));
+}
+
+size_t FrameGraph::findResource(const std::string& name) const
+{
+    for(size_t r = 0; r < resources.size(); r++) {
+        if(resources[r].name == name) {
+            return r;
+        }
+    }
+    throw std::invalid_argument("FrameGraph: unknown resource " + name);
+}
+
+/**
+ * Stages run in the order they are added whenever their accesses conflict,
+ *   so add them in the order a serial frame would run them.
+ */
+void FrameGraph::addStage(const std::string& name, FrameThread thread, const std::vector<std::string>& reads,
+                          const std::vector<std::string>& writes, StageBody body)
+{
+    Stage stage;
+    stage.name = name;
+    stage.thread = thread;
+    for(const std::string& resource : reads) {
+        stage.reads.push_back(findResource(resource));
+    }
+    for(const std::string& resource : writes) {
+        stage.writes.push_back(findResource(resource));
+    }
+    stage.body = std::move(body);
+    stages.push_back(std::move(stage));
+}
+
+StageTask FrameGraph::runStage(Frame* frame, size_t stage)
+{
+    for(const auto& dependency : frame->dependencies[stage]) {
+        co_await dependency->wait();
+    }
+    co_await ResumeOn{this, stages[stage].thread, stage, frame->index};
+    stages[stage].body(frame->index);
+}
+
+/**
+ * Resolve the new frame's dependencies against the accesses still
+ *   outstanding, then start every stage coroutine.
+ */
+void FrameGraph::launch()
+{
+    std::unique_ptr<Frame> frame(new Frame());
+    frame->index = frameCount++;
+    frame->finished.resize(stages.size());
+    frame->dependencies.resize(stages.size());
+    for(size_t s = 0; s < stages.size(); s++) {
+        frame->finished[s] = std::make_shared<StageEvent>();
+        auto& dependencies = frame->dependencies[s];
+        for(size_t r : stages[s].reads) {
+            Hazard& hazard = hazards[r][frame->index % resources[r].copies];
+            if(hazard.writer) {
+                dependencies.push_back(hazard.writer);
+            }
+        }
+        for(size_t r : stages[s].writes) {
+            Hazard& hazard = hazards[r][frame->index % resources[r].copies];
+            if(hazard.writer) {
+                dependencies.push_back(hazard.writer);
+            }
+            dependencies.insert(dependencies.end(), hazard.readers.begin(), hazard.readers.end());
+        }
+        for(size_t r : stages[s].reads) {
+            hazards[r][frame->index % resources[r].copies].readers.push_back(frame->finished[s]);
+        }
+        for(size_t r : stages[s].writes) {
+            Hazard& hazard = hazards[r][frame->index % resources[r].copies];
+            hazard.writer = frame->finished[s];
+            hazard.readers.clear();
+        }
+    }
+    for(size_t s = 0; s < stages.size(); s++) {
+        StageTask task = runStage(frame.get(), s);
+        task.handle.promise().finished = frame->finished[s].get();
+        frame->coroutines.push_back(task.handle);
+    }
+    Frame* started = frame.get();
+    inFlight.push_back(std::move(frame));
+    for(auto coroutine : started->coroutines) {
+        coroutine.resume();
+    }
+}
+
+/**
+ * Run main-thread stages, or failing that a worker task, until finished()
+ */
+void FrameGraph::pumpUntil(const std::function<bool()>& finished)
+{
+    while(!finished()) {
+        std::coroutine_handle<> stage;
+        {
+            std::lock_guard<std::mutex> guard(mainLock);
+            if(!mainQueue.empty()) {
+                auto first = std::min_element(mainQueue.begin(), mainQueue.end(), [](const MainStage& a, const MainStage& b) {
+                    return a.stage != b.stage ? a.stage < b.stage : a.frame < b.frame;
+                });
+                stage = first->coroutine;
+                mainQueue.erase(first);
+            }
+        }
+        if(stage) {
+            stage.resume();
+            continue;
+        }
+        if(scheduler.tryRun()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mainLock);
+        mainReady.wait_for(lock, IDLE_WAIT, [this]() { return !mainQueue.empty(); });
+    }
+}
+
+void FrameGraph::runFrame()
+{
+    launch();
+    while(inFlight.size() >= MAX_FRAMES_IN_FLIGHT) {
+        Frame* oldest = inFlight.front().get();
+        pumpUntil([oldest]() { return oldest->isDone(); });
+        inFlight.pop_front();
+    }
+}
+
+/**
+ * Drain every frame in flight, e.g. before the GL context goes away
+ */
+void FrameGraph::finish()
+{
+    while(!inFlight.empty()) {
+        Frame* oldest = inFlight.front().get();
+        pumpUntil([oldest]() { return oldest->isDone(); });
+        inFlight.pop_front();
+    }
+    scheduler.wait(workerTasks);
+}
+
+uint64_t FrameGraph::getFrameCount() const
+{
+    return frameCount;
+}
@@ -0,0 +1,182 @@
+#ifndef FRAME_GRAPH_HPP
+#define FRAME_GRAPH_HPP
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <taskscheduler.hpp>
+#include <thread>
+#include <vector>
+
+// Where a stage's body has to run: the thread owning the GL context, or any
+//   of the scheduler's workers
+enum class FrameThread
+{
+    Main = 0,
+    Worker
+};
+
+/**
+ * Completion flag a coroutine can co_await. Waiters registered before the
+ *   signal are resumed by the signalling thread.
+*/
+class StageEvent
+{
+    std::mutex lock;
+    bool done;
+    std::vector<std::coroutine_handle<>> waiters;
+
+    bool registerWaiter(std::coroutine_handle<> waiter);
+
+public:
+    struct Awaiter {
+        StageEvent* event;
+        bool await_ready() { return event->isDone(); }
+        bool await_suspend(std::coroutine_handle<> waiter) { return event->registerWaiter(waiter); }
+        void await_resume() {}
+    };
+
+    StageEvent() : done(false) {}
+
+    bool isDone();
+    void signal();
+    Awaiter wait() { return Awaiter{this}; }
+};
+
+/**
+ * Coroutine type of a stage. It starts suspended so the graph can hand it
+ *   its completion event, and signals that event only once it is suspended
+ *   for good, so the frame can be destroyed as soon as the event fires.
+*/
+struct StageTask
+{
+    struct promise_type {
+        StageEvent* finished = nullptr;
+
+        StageTask get_return_object()
+        {
+            return StageTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() { return {}; }
+        auto final_suspend() noexcept
+        {
+            struct Signal {
+                bool await_ready() noexcept { return false; }
+                void await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                {
+                    handle.promise().finished->signal();
+                }
+                void await_resume() noexcept {}
+            };
+            return Signal{};
+        }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+/**
+ * Per-frame task graph. Each stage is a coroutine that waits for the stages
+ *   its data depends on, moves itself onto the main thread or a worker, and
+ *   runs its body. Dependencies come from the resources every stage declares
+ *   it reads and writes: a read waits for the last write, a write for the
+ *   last write and every read since, across frames as well as within one.
+ *   A resource with several copies is indexed by frame, so frame N + 1 can
+ *   fill one copy while frame N is still drawing from the other.
+ *
+ *   runFrame() launches the next frame and then works through main-thread
+ *   stages (and helps the workers) until at most one frame is left in
+ *   flight. Of the main-thread stages ready, the earliest added goes first,
+ *   then the oldest frame's, so the next frame's input is taken before this
+ *   frame's draw, and the next frame's worker stages overlap this frame's
+ *   GL submission.
+*/
+class FrameGraph
+{
+public:
+    typedef std::function<void(uint64_t frame)> StageBody;
+
+private:
+    struct Stage {
+        std::string name;
+        FrameThread thread;
+        std::vector<size_t> reads, writes;
+        StageBody body;
+    };
+    struct Resource {
+        std::string name;
+        unsigned copies;
+    };
+    // Outstanding accesses to one copy of a resource
+    struct Hazard {
+        std::shared_ptr<StageEvent> writer;
+        std::vector<std::shared_ptr<StageEvent>> readers;
+    };
+    struct Frame {
+        uint64_t index;
+        std::vector<std::shared_ptr<StageEvent>> finished;
+        std::vector<std::vector<std::shared_ptr<StageEvent>>> dependencies;
+        std::vector<std::coroutine_handle<StageTask::promise_type>> coroutines;
+        ~Frame();
+        bool isDone() const;
+    };
+    // Awaiter that moves a stage onto the thread it asked for
+    struct ResumeOn {
+        FrameGraph* graph;
+        FrameThread thread;
+        size_t stage;
+        uint64_t frame;
+        bool await_ready() const;
+        void await_suspend(std::coroutine_handle<> coroutine);
+        void await_resume() {}
+    };
+    // A main-thread stage ready to run
+    struct MainStage {
+        size_t stage;
+        uint64_t frame;
+        std::coroutine_handle<> coroutine;
+    };
+
+    TaskScheduler& scheduler;
+    std::thread::id mainThread;
+    std::vector<Stage> stages;
+    std::vector<Resource> resources;
+    std::vector<std::vector<Hazard>> hazards;
+    std::deque<std::unique_ptr<Frame>> inFlight;
+    uint64_t frameCount;
+
+    // Stages waiting to run on the main thread, and the workers' tasks
+    std::mutex mainLock;
+    std::condition_variable mainReady;
+    std::vector<MainStage> mainQueue;
+    TaskGroup workerTasks;
+
+    size_t findResource(const std::string& name) const;
+    StageTask runStage(Frame* frame, size_t stage);
+    void launch();
+    void pumpUntil(const std::function<bool()>& finished);
+
+public:
+    static const size_t MAX_FRAMES_IN_FLIGHT = 2;
+
+    // Construct on the thread that will call runFrame, i.e. the GL thread
+    explicit FrameGraph(TaskScheduler& scheduler);
+    ~FrameGraph();
+
+    void addResource(const std::string& name, unsigned copies = 1);
+    void addStage(const std::string& name, FrameThread thread, const std::vector<std::string>& reads,
+                  const std::vector<std::string>& writes, StageBody body);
+
+    void runFrame();
+    void finish();
+    uint64_t getFrameCount() const;
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include <frustum.hpp>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FRUSTUM_X86
+#include <immintrin.h>
+#endif
+
+// Index of the near plane, whose distances order the spheres front to back
+const unsigned NEAR_PLANE = 4;
+
+Frustum::Frustum()
+{
+    for(unsigned p = 0; p < FRUSTUM_PLANES; p++) {
+        planes[p] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+}
+
+/**
+ * Each plane is the last row of the matrix plus or minus one of the others
+ *   (Gribb and Hartmann), scaled so its normal has unit length
+ */
+Frustum::Frustum(const glm::mat4& viewProjection)
+{
+    const glm::mat4 rows = glm::transpose(viewProjection);
+    for(unsigned axis = 0; axis < 3; axis++) {
+        planes[2 * axis] = rows[3] + rows[axis];
+        planes[2 * axis + 1] = rows[3] - rows[axis];
+    }
+    for(unsigned p = 0; p < FRUSTUM_PLANES; p++) {
+        planes[p] /= glm::length(glm::vec3(planes[p]));
+    }
+}
+
+bool Frustum::containsSphere(const glm::vec3& center, float radius) const
+{
+    for(unsigned p = 0; p < FRUSTUM_PLANES; p++) {
+        if(glm::dot(glm::vec3(planes[p]), center) + planes[p].w < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static size_t cullScalar(const Frustum& frustum, const float* x, const float* y, const float* z, const float* radius,
+                         size_t begin, size_t end, unsigned char* visible, float* depth)
+{
+    size_t kept = 0;
+    for(size_t i = begin; i < end; i++) {
+        const glm::vec3 center(x[i], y[i], z[i]);
+        visible[i] = frustum.containsSphere(center, radius[i]);
+        depth[i] = glm::dot(glm::vec3(frustum.planes[NEAR_PLANE]), center) + frustum.planes[NEAR_PLANE].w;
+        kept += visible[i];
+    }
+    return kept;
+}
+
+#ifdef FRUSTUM_X86
+
+static bool hasAVX()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx");
+}
+
+/**
+ * Eight spheres per step: every plane's signed distance for all eight at
+ *   once, with a sphere dropped as soon as one plane has it below -radius.
+ *   The arithmetic is containsSphere's, in the same order, so both paths
+ *   keep exactly the same spheres.
+ */
+__attribute__((target("avx")))
+static size_t cullAVX(const Frustum& frustum, const float* x, const float* y, const float* z, const float* radius,
+                      size_t count, unsigned char* visible, float* depth)
+{
+    size_t kept = 0;
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        const __m256 cx = _mm256_loadu_ps(x + i);
+        const __m256 cy = _mm256_loadu_ps(y + i);
+        const __m256 cz = _mm256_loadu_ps(z + i);
+        const __m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(radius + i));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        __m256 nearDistance = _mm256_setzero_ps();
+        for(unsigned p = 0; p < FRUSTUM_PLANES; p++) {
+            const glm::vec4& plane = frustum.planes[p];
+            __m256 distance = _mm256_mul_ps(_mm256_set1_ps(plane.x), cx);
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(plane.y), cy));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(plane.z), cz));
+            distance = _mm256_add_ps(distance, _mm256_set1_ps(plane.w));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_NLT_UQ));
+            if(p == NEAR_PLANE) {
+                nearDistance = distance;
+            }
+        }
+        _mm256_storeu_ps(depth + i, nearDistance);
+        const int mask = _mm256_movemask_ps(inside);
+        for(unsigned lane = 0; lane < 8; lane++) {
+            visible[i + lane] = (mask >> lane) & 1;
+        }
+        kept += __builtin_popcount(mask);
+    }
+    return kept + cullScalar(frustum, x, y, z, radius, i, count, visible, depth);
+}
+
+#endif
+
+size_t cullSpheres(const Frustum& frustum, const float* x, const float* y, const float* z, const float* radius,
+                   size_t count, unsigned char* visible, float* depth)
+{
+#ifdef FRUSTUM_X86
+    static const bool avx = hasAVX();
+    if(avx) {
+        return cullAVX(frustum, x, y, z, radius, count, visible, depth);
+    }
+#endif
+    return cullScalar(frustum, x, y, z, radius, 0, count, visible, depth);
+}
@@ -0,0 +1,36 @@
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+#include <cstddef>
+#include <glm/glm.hpp>
+
+// Left, right, bottom, top, near and far
+const unsigned FRUSTUM_PLANES = 6;
+
+/**
+ * The planes bounding what a view-projection matrix can see, each as a
+ *   unit normal pointing inward and an offset, so a point's signed distance
+ *   from plane p is dot(p.xyz, point) + p.w. A default frustum contains
+ *   everything.
+*/
+struct Frustum
+{
+    glm::vec4 planes[FRUSTUM_PLANES];
+
+    Frustum();
+    explicit Frustum(const glm::mat4& viewProjection);
+
+    // False only if the sphere lies wholly outside one of the planes
+    bool containsSphere(const glm::vec3& center, float radius) const;
+};
+
+/**
+ * containsSphere over count spheres given as structure-of-arrays, eight at
+ *   a time with AVX where the CPU has it. visible[i] is set to whether
+ *   sphere i is kept and depth[i] to its center's distance in front of the
+ *   near plane, for ordering them front to back. Returns how many are kept.
+ */
+size_t cullSpheres(const Frustum& frustum, const float* x, const float* y, const float* z, const float* radius,
+                   size_t count, unsigned char* visible, float* depth);
+
+#endif
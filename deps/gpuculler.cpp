@@ -0,0 +1,183 @@
+#include <gpuculler.hpp>
+#include <GLFW/glfw3.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// Invocations per work group, as declared in the compute shader
+const GLuint CULL_GROUP_SIZE = 64;
+
+GpuCuller::GpuCuller()
+    : program(0), culledBuffer(0), commandBuffer(0), cursorBuffer(0), culledBytes(0), dispatchCompute(nullptr),
+      memoryBarrier(nullptr), multiDrawElementsIndirect(nullptr)
+{
+}
+
+/**
+ * Compile and link the compute shader, with the level count filled in.
+ *   Failure is reported and leaves the culler unsupported.
+ */
+bool GpuCuller::compileProgram(const std::string& computePath)
+{
+    std::ifstream file(computePath);
+    if(!file) {
+        std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ " << computePath << std::endl;
+        return false;
+    }
+    std::stringstream stream;
+    stream << file.rdbuf();
+    std::string source = stream.str();
+    const std::string placeholder = "SPHERE_LOD_COUNT";
+    const std::string levels = std::to_string(SPHERE_LOD_COUNT) + "u";
+    for(size_t index = source.find(placeholder); index != std::string::npos; index = source.find(placeholder, index)) {
+        source.replace(index, placeholder.size(), levels);
+    }
+
+    int success;
+    char infoLog[512];
+    const char* code = source.c_str();
+    GLuint compute = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(compute, 1, &code, NULL);
+    glCompileShader(compute);
+    glGetShaderiv(compute, GL_COMPILE_STATUS, &success);
+    if(!success) {
+        glGetShaderInfoLog(compute, 512, NULL, infoLog);
+        std::cout << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n" << infoLog << std::endl;
+        glDeleteShader(compute);
+        return false;
+    }
+    program = glCreateProgram();
+    glAttachShader(program, compute);
+    glLinkProgram(program);
+    glDeleteShader(compute);
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if(!success) {
+        glGetProgramInfoLog(program, 512, NULL, infoLog);
+        std::cout << "ERROR:SHADER:PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        glDeleteProgram(program);
+        program = 0;
+        return false;
+    }
+    return true;
+}
+
+bool GpuCuller::generate(const std::string& computePath, const std::vector<SphereLod>& lods)
+{
+    // The shader is GLSL 4.30, and the indirect commands need base instances
+    //   (4.2), so the extensions alone on an older context aren't enough
+    const bool supported = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 3);
+    if(supported) {
+        dispatchCompute = (DispatchComputeProc) glfwGetProcAddress("glDispatchCompute");
+        memoryBarrier = (MemoryBarrierProc) glfwGetProcAddress("glMemoryBarrier");
+        multiDrawElementsIndirect = (MultiDrawElementsIndirectProc) glfwGetProcAddress("glMultiDrawElementsIndirect");
+    }
+    if(!dispatchCompute || !memoryBarrier || !multiDrawElementsIndirect || !compileProgram(computePath)) {
+        dispatchCompute = nullptr;
+        std::cout << "Culling: on the CPU" << std::endl;
+        return false;
+    }
+
+    emptyCommands.clear();
+    lodResolutions.clear();
+    for(const SphereLod& lod : lods) {
+        emptyCommands.push_back(DrawElementsIndirectCommand{ lod.indexCount, 0, lod.firstIndex, 0, 0 });
+        lodResolutions.push_back((float) lod.resolution);
+    }
+    glGenBuffers(1, &culledBuffer);
+    glGenBuffers(1, &commandBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, emptyCommands.size() * sizeof(DrawElementsIndirectCommand), emptyCommands.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glGenBuffers(1, &cursorBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cursorBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, lods.size() * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    std::cout << "Culling: compute shader and multi-draw indirect" << std::endl;
+    return true;
+}
+
+void GpuCuller::remove()
+{
+    if(!isSupported()) {
+        return;
+    }
+    glDeleteProgram(program);
+    glDeleteBuffers(1, &culledBuffer);
+    glDeleteBuffers(1, &commandBuffer);
+    glDeleteBuffers(1, &cursorBuffer);
+    program = 0;
+    culledBytes = 0;
+    dispatchCompute = nullptr;
+}
+
+bool GpuCuller::isSupported() const
+{
+    return dispatchCompute != nullptr;
+}
+
+void GpuCuller::dispatch(GLuint pass, GLuint groups)
+{
+    glUniform1ui(glGetUniformLocation(program, "cullPass"), pass);
+    dispatchCompute(groups, 1, 1);
+}
+
+/**
+ * Three passes over the instances: count the survivors of each level into
+ *   its command, turn the counts into each level's first instance, then
+ *   copy every survivor to the next free place in its level's run. The
+ *   order within a level is whatever the atomics make it.
+ */
+void GpuCuller::cull(GLuint instanceBuffer, GLintptr offset, GLuint count, bool compact,
+                     const glm::vec3& origin, const glm::vec3& extent, const glm::mat4& view,
+                     const glm::mat4& projection, float lodSectorScale)
+{
+    // Matches the compute shader's instanceStride
+    const GLsizeiptr stride = (compact ? 3 : 4) * sizeof(GLuint);
+    if(count * stride > culledBytes) {
+        culledBytes = count * stride;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, culledBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, culledBytes, nullptr, GL_DYNAMIC_COPY);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, emptyCommands.size() * sizeof(DrawElementsIndirectCommand), emptyCommands.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    if(count == 0) {
+        return;
+    }
+
+    const Frustum frustum(projection * view);
+    glUseProgram(program);
+    glUniform1ui(glGetUniformLocation(program, "instanceCount"), count);
+    glUniform1i(glGetUniformLocation(program, "compactInstances"), compact);
+    glUniform3fv(glGetUniformLocation(program, "instanceOrigin"), 1, &origin[0]);
+    glUniform3fv(glGetUniformLocation(program, "instanceExtent"), 1, &extent[0]);
+    glUniform1i(glGetUniformLocation(program, "sphereAttributes"), 1);
+    glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, &view[0][0]);
+    glUniform4fv(glGetUniformLocation(program, "frustumPlanes"), FRUSTUM_PLANES, &frustum.planes[0][0]);
+    glUniform1f(glGetUniformLocation(program, "lodSectorScale"), lodSectorScale);
+    glUniform1fv(glGetUniformLocation(program, "lodResolutions"), lodResolutions.size(), lodResolutions.data());
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer, offset, count * stride);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, culledBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, cursorBuffer);
+
+    const GLuint groups = (count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE;
+    dispatch(0, groups);
+    memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    dispatch(1, 1);
+    memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    dispatch(2, groups);
+    memoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+}
+
+GLuint GpuCuller::getCulledBuffer() const
+{
+    return culledBuffer;
+}
+
+void GpuCuller::draw()
+{
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, emptyCommands.size(), 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
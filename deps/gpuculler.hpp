@@ -0,0 +1,95 @@
+#ifndef GPU_CULLER_HPP
+#define GPU_CULLER_HPP
+
+#include <entity.hpp>
+#include <frustum.hpp>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+// Compute shaders, storage buffers and multi-draw indirect are GL 4.3,
+//   past what glad loads
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+#ifndef GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#endif
+#ifndef GL_COMMAND_BARRIER_BIT
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#endif
+typedef void (APIENTRYP DispatchComputeProc)(GLuint groupsX, GLuint groupsY, GLuint groupsZ);
+typedef void (APIENTRYP MemoryBarrierProc)(GLbitfield barriers);
+typedef void (APIENTRYP MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void* indirect, GLsizei drawCount, GLsizei stride);
+
+/**
+ * One indirect draw, laid out as glMultiDrawElementsIndirect reads it
+*/
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+/**
+ * Frustum culling and level-of-detail selection on the GPU. A compute
+ *   shader tests every instance of a frame against the view frustum, picks
+ *   its level the way the CPU would, and copies the survivors, grouped by
+ *   level, into a compacted buffer of its own while filling one indirect
+ *   command per level. A single glMultiDrawElementsIndirect then draws
+ *   them, with each command's base instance pointing its level's run.
+ *
+ *   generate() reports whether the context can do all of this; if not,
+ *   nothing else may be called and the CPU path stays in charge. GL calls
+ *   belong on the thread that owns the context.
+*/
+class GpuCuller
+{
+    GLuint program;
+    GLuint culledBuffer, commandBuffer, cursorBuffer;
+    GLsizeiptr culledBytes;
+    DispatchComputeProc dispatchCompute;
+    MemoryBarrierProc memoryBarrier;
+    MultiDrawElementsIndirectProc multiDrawElementsIndirect;
+    // Every level's command with no instances yet, to reset them each frame
+    std::vector<DrawElementsIndirectCommand> emptyCommands;
+    std::vector<float> lodResolutions;
+
+    bool compileProgram(const std::string& computePath);
+    void dispatch(GLuint pass, GLuint groups);
+
+public:
+    GpuCuller();
+
+    // Call with the context current and the sphere's levels built
+    bool generate(const std::string& computePath, const std::vector<SphereLod>& lods);
+    void remove();
+    bool isSupported() const;
+
+    /**
+     * Cull count instances, in the compact or full format, from the given
+     *   offset of the instance buffer. The sphere attributes must be bound
+     *   to texture unit 1, as for drawing. lodSectorScale turns a sphere's
+     *   radius over its depth into sectors of outline on screen.
+     */
+    void cull(GLuint instanceBuffer, GLintptr offset, GLuint count, bool compact,
+              const glm::vec3& origin, const glm::vec3& extent, const glm::mat4& view,
+              const glm::mat4& projection, float lodSectorScale);
+    // The survivors of the last cull, for the instance attributes
+    GLuint getCulledBuffer() const;
+    // Draw the last cull's survivors; call with the VAO bound, the instance
+    //   attributes on getCulledBuffer() at offset 0 and the shader in use
+    void draw();
+};
+
+#endif
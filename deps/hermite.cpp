@@ -0,0 +1,228 @@
+#include <hermite.hpp>
+#include <algorithm>
+#include <cmath>
+#include <taskscheduler.hpp>
+
+const uint32_t TICKS_PER_STEP = 1u << HERMITE_MAX_LEVEL;
+
+// The first step of a body has no higher derivatives to go on, so it is
+//   sized from |a| / |j| with this fraction of the usual accuracy
+const float STARTING_ACCURACY_FRACTION = 0.5f;
+
+HermiteIntegrator::HermiteIntegrator(float accuracy)
+{
+    HermiteIntegrator::accuracy = accuracy;
+    initialized = false;
+    blockCount = 0;
+    bodySteps = 0;
+}
+
+void HermiteIntegrator::setAccuracy(float accuracy)
+{
+    HermiteIntegrator::accuracy = accuracy;
+}
+
+float HermiteIntegrator::getAccuracy() const
+{
+    return accuracy;
+}
+
+// Distinct block times visited by the last step
+size_t HermiteIntegrator::getBlockCount() const
+{
+    return blockCount;
+}
+
+// Body corrections performed by the last step; a shared step would need
+//   the body count times the finest block count
+size_t HermiteIntegrator::getBodySteps() const
+{
+    return bodySteps;
+}
+
+/**
+ * Restart from the current state, e.g. after bodies merged
+ */
+void HermiteIntegrator::invalidate()
+{
+    initialized = false;
+}
+
+/**
+ * Taylor-predict every body from the start of its own step to the block time
+ */
+void HermiteIntegrator::predict(const ParticleStore& particles, uint32_t tick, double tickLength)
+{
+    const size_t N = particles.size();
+    for(size_t j = 0; j < N; j++) {
+        const float dt = (tick - ticks[j]) * tickLength;
+        const float dt2 = 0.5f * dt * dt, dt3 = dt * dt2 / 3.0f;
+        px[j] = particles.x[j] + dt * particles.vx[j] + dt2 * particles.ax[j] + dt3 * jx[j];
+        py[j] = particles.y[j] + dt * particles.vy[j] + dt2 * particles.ay[j] + dt3 * jy[j];
+        pz[j] = particles.z[j] + dt * particles.vz[j] + dt2 * particles.az[j] + dt3 * jz[j];
+        pvx[j] = particles.vx[j] + dt * particles.ax[j] + dt2 * jx[j];
+        pvy[j] = particles.vy[j] + dt * particles.ay[j] + dt2 * jy[j];
+        pvz[j] = particles.vz[j] + dt * particles.az[j] + dt2 * jz[j];
+    }
+}
+
+/**
+ * Acceleration and jerk on every active body from the predicted state of
+ *   all bodies. Overlapping pairs are skipped, as in the direct kernel,
+ *   since they are about to merge.
+ */
+void HermiteIntegrator::evaluate(const ParticleStore& particles, float G, unsigned nThreads)
+{
+    const size_t N = particles.size();
+    newAccelerations.resize(active.size());
+    newJerks.resize(active.size());
+    const float* mass = particles.mass.data();
+    const float* radius = particles.radius.data();
+
+    auto evaluateRange = [&](size_t begin, size_t end) {
+        for(size_t k = begin; k < end; k++) {
+            const unsigned i = active[k];
+            float ax = 0.0f, ay = 0.0f, az = 0.0f;
+            float jerkX = 0.0f, jerkY = 0.0f, jerkZ = 0.0f;
+            for(size_t j = 0; j < N; j++) {
+                float dx = px[j] - px[i], dy = py[j] - py[i], dz = pz[j] - pz[i];
+                float dvx = pvx[j] - pvx[i], dvy = pvy[j] - pvy[i], dvz = pvz[j] - pvz[i];
+                float r2 = dx * dx + dy * dy + dz * dz;
+                float s = radius[i] + radius[j];
+                if(r2 <= s * s) {
+                    continue;
+                }
+                float invR2 = 1.0f / r2;
+                float w = mass[j] * invR2 * std::sqrt(invR2);
+                float rv = 3.0f * (dx * dvx + dy * dvy + dz * dvz) * invR2;
+                ax += w * dx;
+                ay += w * dy;
+                az += w * dz;
+                jerkX += w * (dvx - rv * dx);
+                jerkY += w * (dvy - rv * dy);
+                jerkZ += w * (dvz - rv * dz);
+            }
+            newAccelerations[k] = G * glm::vec3(ax, ay, az);
+            newJerks[k] = G * glm::vec3(jerkX, jerkY, jerkZ);
+        }
+    };
+
+    const size_t A = active.size();
+    TaskScheduler::shared().parallelFor(0, A, stealingGrain(A, nThreads, 64), evaluateRange);
+}
+
+/**
+ * Smallest level whose step does not exceed dt
+ */
+int HermiteIntegrator::levelFor(double dt, double physicsStep) const
+{
+    if(!(dt < physicsStep)) {
+        return 0;
+    }
+    if(!(dt > 0.0)) {
+        return HERMITE_MAX_LEVEL;
+    }
+    return std::min((int) std::ceil(std::log2(physicsStep / dt)), HERMITE_MAX_LEVEL);
+}
+
+void HermiteIntegrator::initialize(ParticleStore& particles, float G, double physicsStep, unsigned nThreads)
+{
+    const size_t N = particles.size();
+    ticks.assign(N, 0);
+    levels.assign(N, 0);
+    AlignedFloats* fields[] = { &jx, &jy, &jz, &px, &py, &pz, &pvx, &pvy, &pvz };
+    for(AlignedFloats* field : fields) {
+        field->assign(N, 0.0f);
+    }
+
+    active.resize(N);
+    for(size_t i = 0; i < N; i++) {
+        active[i] = i;
+    }
+    predict(particles, 0, 0.0);
+    evaluate(particles, G, nThreads);
+    for(size_t i = 0; i < N; i++) {
+        const glm::vec3& a = newAccelerations[i];
+        const glm::vec3& j = newJerks[i];
+        particles.accelerations().set(i, a);
+        jx[i] = j.x;
+        jy[i] = j.y;
+        jz[i] = j.z;
+        float jerk = glm::length(j);
+        double dt = jerk > 0.0f ? STARTING_ACCURACY_FRACTION * accuracy * glm::length(a) / jerk : physicsStep;
+        levels[i] = levelFor(dt, physicsStep);
+    }
+    initialized = true;
+}
+
+/**
+ * Advance every body by one physics step. Within it, the bodies due at the
+ *   earliest block time are predicted, corrected and given a new level;
+ *   a level may always drop to a shorter step, but only rises by one, and
+ *   only when the current time is a multiple of the longer step.
+ */
+void HermiteIntegrator::step(ParticleStore& particles, float G, float physicsStep, unsigned nThreads)
+{
+    const size_t N = particles.size();
+    blockCount = 0;
+    bodySteps = 0;
+    if(N == 0 || physicsStep <= 0.0f) {
+        return;
+    }
+    if(!initialized || ticks.size() != N) {
+        initialize(particles, G, physicsStep, nThreads);
+    }
+    const double tickLength = (double) physicsStep / TICKS_PER_STEP;
+
+    uint32_t blockTick = 0;
+    while(blockTick < TICKS_PER_STEP) {
+        blockTick = TICKS_PER_STEP;
+        for(size_t i = 0; i < N; i++) {
+            blockTick = std::min(blockTick, ticks[i] + (TICKS_PER_STEP >> levels[i]));
+        }
+        active.clear();
+        for(size_t i = 0; i < N; i++) {
+            if(ticks[i] + (TICKS_PER_STEP >> levels[i]) == blockTick) {
+                active.push_back(i);
+            }
+        }
+        predict(particles, blockTick, tickLength);
+        evaluate(particles, G, nThreads);
+
+        for(size_t k = 0; k < active.size(); k++) {
+            const unsigned i = active[k];
+            const float dt = (blockTick - ticks[i]) * tickLength;
+            const glm::vec3 a0 = particles.acceleration(i), j0(jx[i], jy[i], jz[i]);
+            const glm::vec3& a1 = newAccelerations[k];
+            const glm::vec3& j1 = newJerks[k];
+            // Snap and crackle at the start of the step from the Hermite interpolant
+            glm::vec3 snap = (-6.0f * (a0 - a1) - dt * (4.0f * j0 + 2.0f * j1)) / (dt * dt);
+            glm::vec3 crackle = (12.0f * (a0 - a1) + 6.0f * dt * (j0 + j1)) / (dt * dt * dt);
+            const float dt2 = dt * dt, dt3 = dt2 * dt, dt4 = dt3 * dt;
+            particles.setLocation(i, glm::vec3(px[i], py[i], pz[i]) + dt4 / 24.0f * snap + dt4 * dt / 120.0f * crackle);
+            particles.setVelocity(i, glm::vec3(pvx[i], pvy[i], pvz[i]) + dt3 / 6.0f * snap + dt4 / 24.0f * crackle);
+            particles.accelerations().set(i, a1);
+            jx[i] = j1.x;
+            jy[i] = j1.y;
+            jz[i] = j1.z;
+
+            // Aarseth criterion with the snap carried to the end of the step
+            snap += dt * crackle;
+            float numerator = glm::length(a1) * glm::length(snap) + glm::dot(j1, j1);
+            float denominator = glm::length(j1) * glm::length(crackle) + glm::dot(snap, snap);
+            double desired = denominator > 0.0f ? std::sqrt(accuracy * numerator / denominator) : physicsStep;
+            int level = levelFor(desired, physicsStep);
+            if(level > levels[i]) {
+                levels[i] = level;
+            }
+            else if(level < levels[i] && blockTick % (TICKS_PER_STEP >> (levels[i] - 1)) == 0) {
+                levels[i]--;
+            }
+            ticks[i] = blockTick;
+        }
+        blockCount++;
+        bodySteps += active.size();
+    }
+    // Every body lands exactly on the end of the physics step
+    std::fill(ticks.begin(), ticks.end(), 0);
+}
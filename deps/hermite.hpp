@@ -0,0 +1,58 @@
+#ifndef HERMITE_HPP
+#define HERMITE_HPP
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <particlestore.hpp>
+#include <vector>
+
+// Finest block level: the shortest step is the physics step / 2^HERMITE_MAX_LEVEL
+const int HERMITE_MAX_LEVEL = 24;
+
+/**
+ * Fourth-order Hermite predictor-corrector with hierarchical block time
+ *   steps. Every body steps at the physics step divided by a power of two,
+ *   picked from the Aarseth criterion, and only the bodies due at the next
+ *   block time are corrected; everything else is merely predicted to it.
+ *   Forces and their time derivative (jerk) come from direct summation over
+ *   the predicted state. Times are kept as integer ticks of the finest level
+ *   so block membership is exact.
+*/
+class HermiteIntegrator
+{
+    float accuracy;
+    bool initialized;
+
+    // Per body: start of its current step and its level, with the jerk
+    //   alongside the acceleration kept in the particle store
+    std::vector<uint32_t> ticks;
+    std::vector<int> levels;
+    AlignedFloats jx, jy, jz;
+
+    // Every body's position and velocity predicted to the block time
+    AlignedFloats px, py, pz, pvx, pvy, pvz;
+
+    std::vector<unsigned> active;
+    std::vector<glm::vec3> newAccelerations, newJerks;
+
+    size_t blockCount;
+    size_t bodySteps;
+
+    void predict(const ParticleStore& particles, uint32_t tick, double tickLength);
+    void evaluate(const ParticleStore& particles, float G, unsigned nThreads);
+    int levelFor(double dt, double physicsStep) const;
+    void initialize(ParticleStore& particles, float G, double physicsStep, unsigned nThreads);
+
+public:
+    HermiteIntegrator(float accuracy = 0.02f);
+
+    void setAccuracy(float accuracy);
+    float getAccuracy() const;
+    size_t getBlockCount() const;
+    size_t getBodySteps() const;
+    void invalidate();
+
+    void step(ParticleStore& particles, float G, float physicsStep, unsigned nThreads = 1);
+};
+
+#endif
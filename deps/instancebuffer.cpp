@@ -0,0 +1,230 @@
+#include <instancebuffer.hpp>
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+// How long one glClientWaitSync call may block before it is retried
+const GLuint64 FENCE_TIMEOUT = 1000000;
+
+InstanceBuffer::InstanceBuffer()
+    : buffer(0), regionBytes(0), cursor(0), drawn(0), bufferStorage(nullptr), persistent(nullptr), stallNanoseconds(0), waits(0)
+{
+    for(unsigned i = 0; i < INSTANCE_BUFFER_REGIONS; i++) {
+        fences[i] = 0;
+    }
+    for(unsigned i = 0; i < INSTANCE_BUFFER_SLOTS; i++) {
+        slotRegions[i] = -1;
+    }
+}
+
+/**
+ * glBufferStorage, if the current context has it
+ */
+static BufferStorageProc loadBufferStorage()
+{
+    bool supported = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 4);
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+    for(GLint i = 0; i < extensionCount && !supported; i++) {
+        const char* extension = (const char*) glGetStringi(GL_EXTENSIONS, i);
+        supported = extension && strcmp(extension, "GL_ARB_buffer_storage") == 0;
+    }
+    if(!supported) {
+        return nullptr;
+    }
+    BufferStorageProc proc = (BufferStorageProc) glfwGetProcAddress("glBufferStorage");
+    return proc ? proc : (BufferStorageProc) glfwGetProcAddress("glBufferStorageARB");
+}
+
+void InstanceBuffer::generate()
+{
+    glGenBuffers(1, &buffer);
+    bufferStorage = loadBufferStorage();
+    std::cout << "Instance buffer: " << (bufferStorage ? "persistent mapped ring" : "copied per frame") << std::endl;
+}
+
+void InstanceBuffer::remove()
+{
+    deleteFences();
+    if(persistent) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+    regionBytes = 0;
+    persistent = nullptr;
+    for(unsigned i = 0; i < INSTANCE_BUFFER_SLOTS; i++) {
+        slotRegions[i] = -1;
+    }
+}
+
+void InstanceBuffer::deleteFences()
+{
+    for(unsigned i = 0; i < INSTANCE_BUFFER_REGIONS; i++) {
+        if(fences[i]) {
+            glDeleteSync(fences[i]);
+            fences[i] = 0;
+        }
+    }
+}
+
+void InstanceBuffer::reserve(GLsizeiptr bytes)
+{
+    bytes = (bytes + INSTANCE_REGION_ALIGNMENT - 1) / INSTANCE_REGION_ALIGNMENT * INSTANCE_REGION_ALIGNMENT;
+    if(bytes <= regionBytes) {
+        return;
+    }
+    // Orphaning the old storage leaves the GPU its copy, so the fences on it
+    //   and the regions handed out no longer matter
+    deleteFences();
+    for(unsigned i = 0; i < INSTANCE_BUFFER_SLOTS; i++) {
+        slotRegions[i] = -1;
+    }
+    regionBytes = bytes;
+    allocate();
+}
+
+/**
+ * Storage for every region. Immutable storage can't be respecified, so a
+ *   persistent ring that grows gets a new buffer; the GPU keeps the old one
+ *   alive until it is done with it.
+ */
+void InstanceBuffer::allocate()
+{
+    const GLsizeiptr totalBytes = regionBytes * INSTANCE_BUFFER_REGIONS;
+    if(!bufferStorage) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, totalBytes, nullptr, GL_STREAM_DRAW);
+        return;
+    }
+    if(persistent) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glDeleteBuffers(1, &buffer);
+        glGenBuffers(1, &buffer);
+    }
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    bufferStorage(GL_ARRAY_BUFFER, totalBytes, nullptr, flags);
+    persistent = (char*) glMapBufferRange(GL_ARRAY_BUFFER, 0, totalBytes, flags);
+}
+
+/**
+ * Block until the GPU has finished the draws fenced on a region. The first
+ *   wait flushes, so the fence is certain to reach the GPU.
+ */
+void InstanceBuffer::waitForRegion(unsigned index)
+{
+    if(!fences[index]) {
+        return;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    for(;;) {
+        GLenum result = glClientWaitSync(fences[index], flags, FENCE_TIMEOUT);
+        if(result != GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+        flags = 0;
+    }
+    glDeleteSync(fences[index]);
+    fences[index] = 0;
+    stallNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * The slot's region, for writing. A slot without one gets the next region
+ *   that neither the other slot holds nor the last draw read, once the GPU
+ *   is done with it; with a persistent ring that is the region's address,
+ *   otherwise the slot's client copy. The pointer may be handed to another
+ *   thread to fill, as long as unmap() waits for it.
+ */
+void* InstanceBuffer::map(unsigned slot)
+{
+    if(slotRegions[slot] < 0) {
+        for(unsigned k = 1; k <= INSTANCE_BUFFER_REGIONS; k++) {
+            const unsigned candidate = (cursor + k) % INSTANCE_BUFFER_REGIONS;
+            bool taken = candidate == drawn;
+            for(unsigned i = 0; i < INSTANCE_BUFFER_SLOTS; i++) {
+                taken |= slotRegions[i] == (int) candidate;
+            }
+            if(!taken) {
+                cursor = candidate;
+                break;
+            }
+        }
+        waitForRegion(cursor);
+        waits++;
+        slotRegions[slot] = cursor;
+    }
+    if(persistent) {
+        return persistent + slotRegions[slot] * regionBytes;
+    }
+    staging[slot].resize(regionBytes);
+    return staging[slot].data();
+}
+
+/**
+ * Finish writing the slot's region and return its offset in the buffer, for
+ *   the attribute pointers of the draws that read it. Coherent writes need
+ *   no flush, so a persistent ring only hands the region over; otherwise the
+ *   first bytes of the client copy are uploaded into it.
+ */
+GLintptr InstanceBuffer::unmap(unsigned slot, GLsizeiptr bytes)
+{
+    if(slotRegions[slot] < 0) {
+        return drawn * regionBytes;
+    }
+    drawn = slotRegions[slot];
+    slotRegions[slot] = -1;
+    if(!persistent && bytes > 0) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, drawn * regionBytes, std::min(bytes, regionBytes), staging[slot].data());
+    }
+    return drawn * regionBytes;
+}
+
+/**
+ * Return the offset of the region drawn last, to draw it again. The slot
+ *   keeps its region unwritten for the next time round.
+ */
+GLintptr InstanceBuffer::reuse()
+{
+    return drawn * regionBytes;
+}
+
+/**
+ * Call after the last draw reading the region unmap() or reuse() returned
+ */
+void InstanceBuffer::fence()
+{
+    if(fences[drawn]) {
+        glDeleteSync(fences[drawn]);
+    }
+    fences[drawn] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+GLuint InstanceBuffer::getBuffer() const
+{
+    return buffer;
+}
+
+bool InstanceBuffer::isPersistent() const
+{
+    return persistent != nullptr;
+}
+
+GLsizeiptr InstanceBuffer::getRegionBytes() const
+{
+    return regionBytes;
+}
+
+double InstanceBuffer::takeAverageStall()
+{
+    const uint64_t count = waits.exchange(0);
+    const uint64_t nanoseconds = stallNanoseconds.exchange(0);
+    return count > 0 ? nanoseconds * 1e-9 / count : 0.0;
+}
@@ -0,0 +1,84 @@
+#ifndef INSTANCE_BUFFER_HPP
+#define INSTANCE_BUFFER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <glad/glad.h>
+#include <vector>
+
+// glBufferStorage is GL 4.4 (or ARB_buffer_storage), past what glad loads
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+typedef void (APIENTRYP BufferStorageProc)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+// Regions the CPU may be filling at once, one per render state copy, so the
+//   next frame's region is already mapped while this one is drawn
+const unsigned INSTANCE_BUFFER_SLOTS = 2;
+// Those, plus the frames of instance data the GPU may be behind
+const unsigned INSTANCE_BUFFER_REGIONS = INSTANCE_BUFFER_SLOTS + 2;
+// Regions start on multiples of this, the largest offset alignment GL may
+//   ask of a buffer binding, so each can also be bound as storage
+const GLsizeiptr INSTANCE_REGION_ALIGNMENT = 256;
+
+/**
+ * Per-instance vertex data in one buffer split into a ring of regions. Each
+ *   slot holds a region for the CPU to fill while the GPU is still drawing
+ *   from the others; a fence placed after the draws that read a region tells
+ *   map() when it may be written again, and the time spent waiting on it is
+ *   recorded. A frame whose data did not change draws the last region again
+ *   with reuse(), and its slot keeps the region it would have written.
+ *
+ *   Where the context has buffer storage, the whole ring is mapped once,
+ *   persistently and coherently, so a frame's writes land in GPU-visible
+ *   memory with no unmap or copy. Otherwise each slot is filled in client
+ *   memory and copied into its region when it is unmapped, since a buffer
+ *   can't be drawn from while a range of it is mapped.
+ *
+ *   GL calls (everything but writing through the mapped pointer) belong on
+ *   the thread that owns the context.
+*/
+class InstanceBuffer
+{
+    GLuint buffer;
+    GLsizeiptr regionBytes;
+    GLsync fences[INSTANCE_BUFFER_REGIONS];
+    int slotRegions[INSTANCE_BUFFER_SLOTS];  // -1 while a slot has none
+    unsigned cursor;
+    unsigned drawn;
+    std::vector<char> staging[INSTANCE_BUFFER_SLOTS];
+    BufferStorageProc bufferStorage;
+    char* persistent;
+    std::atomic<uint64_t> stallNanoseconds;
+    std::atomic<uint64_t> waits;
+
+    void waitForRegion(unsigned index);
+    void deleteFences();
+    void allocate();
+
+public:
+    InstanceBuffer();
+
+    // Call with the context current; picks the persistent path if it can
+    void generate();
+    void remove();
+    // Bytes per region; reallocates, dropping every slot's region, when it
+    //   grows
+    void reserve(GLsizeiptr bytes);
+
+    void* map(unsigned slot);
+    GLintptr unmap(unsigned slot, GLsizeiptr bytes);
+    GLintptr reuse();
+    void fence();
+
+    GLuint getBuffer() const;
+    bool isPersistent() const;
+    GLsizeiptr getRegionBytes() const;
+    // Average wait per map() since the last call, in seconds
+    double takeAverageStall();
+};
+
+#endif
@@ -0,0 +1,256 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <instancewriter.hpp>
+#include <limits>
+#include <taskscheduler.hpp>
+
+// Instances per task when the render state is rebuilt
+const size_t INSTANCE_GRAIN = 4096;
+
+InstanceWriter::InstanceWriter()
+    : version(0), snapshotVersion(0), attributeVersion(0), settled(false), mode(RenderMode::Mesh), cullView(1.0f),
+      cullProjection(1.0f), cullPixelScale(1.0f)
+{
+}
+
+/**
+ * @brief InstanceWriter::measure
+ * Bounds of the first count spheres of a snapshot
+ */
+InstanceBounds InstanceWriter::measure(const PhysicsSnapshot& snapshot, size_t count)
+{
+    const float infinity = std::numeric_limits<float>::infinity();
+    const InstanceBounds empty = { glm::vec3(infinity), glm::vec3(-infinity), infinity };
+    return TaskScheduler::shared().parallelReduce(0, count, INSTANCE_GRAIN, empty, [&](size_t begin, size_t end) {
+        InstanceBounds bounds = empty;
+        for(size_t i = begin; i < end; i++) {
+            glm::vec3 previous(snapshot.previousX[i], snapshot.previousY[i], snapshot.previousZ[i]);
+            glm::vec3 current(snapshot.x[i], snapshot.y[i], snapshot.z[i]);
+            bounds.lower = glm::min(bounds.lower, glm::min(previous, current));
+            bounds.upper = glm::max(bounds.upper, glm::max(previous, current));
+            bounds.minRadius = std::min(bounds.minRadius, snapshot.radius[i]);
+        }
+        return bounds;
+    }, [](const InstanceBounds& a, const InstanceBounds& b) {
+        return InstanceBounds{ glm::min(a.lower, b.lower), glm::max(a.upper, b.upper), std::min(a.minRadius, b.minRadius) };
+    });
+}
+
+/**
+ * @brief InstanceWriter::selectLod
+ * Coarsest level of detail whose sectors still span at most
+ *   LOD_PIXELS_PER_SECTOR pixels of the sphere's outline. A sphere wholly
+ *   behind the camera gets the coarsest, one the camera is inside the finest.
+ */
+GLuint InstanceWriter::selectLod(const glm::vec3& location, float radius, const glm::mat4& view, float pixelScale)
+{
+    const float depth = -(view[0][2] * location.x + view[1][2] * location.y + view[2][2] * location.z + view[3][2]);
+    if(depth <= -radius) {
+        return SPHERE_LOD_COUNT - 1;
+    }
+    if(depth <= radius) {
+        return 0;
+    }
+    const float sectors = 2.0f * M_PI * radius * pixelScale / depth / LOD_PIXELS_PER_SECTOR;
+    for(GLuint level = SPHERE_LOD_COUNT - 1; level > 0; level--) {
+        if(SPHERE_LOD_RESOLUTIONS[level] >= sectors) {
+            return level;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief InstanceWriter::depthBucket
+ * Depth bucket of a sphere whose center is the given distance in front of
+ *   the near plane: the exponent and top three mantissa bits of the float,
+ *   so an eighth of a binade each, from DEPTH_BUCKET_NEAREST on
+ */
+GLuint InstanceWriter::depthBucket(float depth)
+{
+    if(!(depth > DEPTH_BUCKET_NEAREST)) {
+        return 0;
+    }
+    uint32_t bits;
+    std::memcpy(&bits, &depth, sizeof(bits));
+    uint32_t nearest;
+    std::memcpy(&nearest, &DEPTH_BUCKET_NEAREST, sizeof(nearest));
+    return std::min((bits >> 20) - (nearest >> 20), DEPTH_BUCKETS - 1);
+}
+
+glm::vec3 InstanceWriter::locationAt(size_t i) const
+{
+    return glm::vec3(interpolatedX[i], interpolatedY[i], interpolatedZ[i]);
+}
+
+/**
+ * @brief InstanceWriter::write
+ * Build state from the first count spheres of the snapshot, interpolated
+ *   by alpha from its previous to its current locations, for the mode,
+ *   view and projection already set on state; last is the state of the
+ *   frame before.
+ *   Instances go to region, which must hold count full-format instances.
+ *
+ *   The compact instance format is chosen whenever 16-bit steps across the
+ *   frame's bounding box are small next to the smallest sphere; otherwise
+ *   the full float format is written. Nothing is written at all while the
+ *   snapshot, its attributes, interpolation, mode, view and projection
+ *   stand still: state takes over last's instances and sets reuseInstances.
+ *   Unless meshes are culled on the GPU, only the spheres in the view
+ *   frustum are written, sorted by the level of detail their size on screen
+ *   calls for and then roughly front to back.
+ */
+void InstanceWriter::write(RenderState& state, const RenderState& last, const PhysicsSnapshot& snapshot, size_t count,
+                           float alpha, bool gpuCulled, void* region)
+{
+    // Meshes culled on the GPU are written whole, in sphere order, and get
+    //   their levels of detail there. Everything else is culled here and
+    //   sorted front to back, meshes by level first.
+    const size_t N = count;
+    const glm::mat4 view = state.view;
+    const glm::mat4 projection = state.projection;
+    const float pixelScale = state.pixelScale;
+    const bool cpuCull = state.mode != RenderMode::Mesh || !gpuCulled;
+    const bool cpuLevels = state.mode == RenderMode::Mesh && !gpuCulled;
+
+    // Same snapshot and attributes, already drawn at its final position
+    //   (e.g. while paused) in the same mode from the same viewpoint and
+    //   projection: the last frame's instances, levels of detail and lights
+    //   still hold. Without culling on the CPU, neither the viewpoint nor
+    //   the projection matters.
+    if(snapshot.version == snapshotVersion && snapshot.attributeVersion == attributeVersion && settled && state.mode == mode
+       && (!cpuCull || (view == cullView && projection == cullProjection && pixelScale == cullPixelScale))) {
+        if(&state != &last) {
+            state.count = last.count;
+            state.lights = last.lights;
+            state.version = last.version;
+            state.compact = last.compact;
+            state.origin = last.origin;
+            state.extent = last.extent;
+            std::copy(last.lodFirst, last.lodFirst + SPHERE_LOD_COUNT, state.lodFirst);
+            std::copy(last.lodCount, last.lodCount + SPHERE_LOD_COUNT, state.lodCount);
+        }
+        state.reuseInstances = true;
+        return;
+    }
+    snapshotVersion = snapshot.version;
+    attributeVersion = snapshot.attributeVersion;
+    settled = alpha >= 1.0f;
+    mode = state.mode;
+    cullView = view;
+    cullProjection = projection;
+    cullPixelScale = pixelScale;
+    state.reuseInstances = false;
+    state.version = ++version;
+
+    const InstanceBounds bounds = measure(snapshot, N);
+    const glm::vec3 extent = bounds.upper - bounds.lower;
+    const float fixedStep = std::max(std::max(extent.x, extent.y), extent.z) / FIXED_MAX;
+    state.compact = N > 0 && fixedStep <= COMPACT_TOLERANCE * bounds.minRadius;
+    state.origin = state.compact ? bounds.lower : glm::vec3(0.0f);
+    state.extent = state.compact ? extent : glm::vec3(1.0f);
+    glm::vec3 toFixed(0.0f);
+    for(int k = 0; k < 3; k++) {
+        toFixed[k] = extent[k] > 0.0f ? FIXED_MAX / extent[k] : 0.0f;
+    }
+
+    // Counting sort on (level of detail, depth bucket): each chunk
+    //   interpolates and culls its instances and counts its keys, the counts
+    //   become each chunk's first slot per key, and then every chunk writes
+    //   its visible instances from there. Only what survives is written,
+    //   so off-screen spheres cost neither upload nor vertex work.
+    const size_t chunks = (N + INSTANCE_GRAIN - 1) / INSTANCE_GRAIN;
+    const size_t keyCount = SPHERE_LOD_COUNT * DEPTH_BUCKETS;
+    const Frustum frustum = cpuCull ? Frustum(projection * view) : Frustum();
+    interpolatedX.resize(N);
+    interpolatedY.resize(N);
+    interpolatedZ.resize(N);
+    visible.resize(N);
+    depths.resize(N);
+    keys.resize(N);
+    sortOffsets.assign(chunks * keyCount, 0);
+    TaskScheduler& scheduler = TaskScheduler::shared();
+    scheduler.parallelFor(0, chunks, 1, [&, pixelScale, alpha](size_t firstChunk, size_t lastChunk) {
+        for(size_t c = firstChunk; c < lastChunk; c++) {
+            const size_t begin = c * INSTANCE_GRAIN;
+            const size_t end = std::min(begin + INSTANCE_GRAIN, N);
+            for(size_t i = begin; i < end; i++) {
+                interpolatedX[i] = snapshot.previousX[i] * (1.0f - alpha) + snapshot.x[i] * alpha;
+                interpolatedY[i] = snapshot.previousY[i] * (1.0f - alpha) + snapshot.y[i] * alpha;
+                interpolatedZ[i] = snapshot.previousZ[i] * (1.0f - alpha) + snapshot.z[i] * alpha;
+            }
+            if(cpuCull) {
+                cullSpheres(frustum, &interpolatedX[begin], &interpolatedY[begin], &interpolatedZ[begin], &snapshot.radius[begin],
+                            end - begin, &visible[begin], &depths[begin]);
+            }
+            else {
+                std::fill(visible.begin() + begin, visible.begin() + end, 1);
+            }
+            GLuint* counts = &sortOffsets[c * keyCount];
+            for(size_t i = begin; i < end; i++) {
+                if(!visible[i]) {
+                    continue;
+                }
+                GLuint key = 0;
+                if(cpuCull) {
+                    const GLuint level = cpuLevels ? selectLod(locationAt(i), snapshot.radius[i], view, pixelScale) : 0;
+                    key = level * DEPTH_BUCKETS + depthBucket(depths[i]);
+                }
+                keys[i] = key;
+                counts[key]++;
+            }
+        }
+    });
+    GLuint next = 0;
+    for(GLuint level = 0; level < SPHERE_LOD_COUNT; level++) {
+        state.lodFirst[level] = next;
+        for(size_t key = level * DEPTH_BUCKETS; key < (level + 1) * DEPTH_BUCKETS; key++) {
+            for(size_t c = 0; c < chunks; c++) {
+                const GLuint keyed = sortOffsets[c * keyCount + key];
+                sortOffsets[c * keyCount + key] = next;
+                next += keyed;
+            }
+        }
+        state.lodCount[level] = next - state.lodFirst[level];
+    }
+    state.count = next;
+
+    const bool compact = state.compact;
+    const glm::vec3 origin = state.origin;
+    scheduler.parallelFor(0, chunks, 1, [&, compact, origin, toFixed](size_t firstChunk, size_t lastChunk) {
+        for(size_t c = firstChunk; c < lastChunk; c++) {
+            GLuint* offsets = &sortOffsets[c * keyCount];
+            for(size_t i = c * INSTANCE_GRAIN; i < std::min((c + 1) * INSTANCE_GRAIN, N); i++) {
+                if(!visible[i]) {
+                    continue;
+                }
+                const glm::vec3 location = locationAt(i);
+                const GLuint target = offsets[keys[i]]++;
+                if(compact) {
+                    CompactSphereInstance& instance = ((CompactSphereInstance*) region)[target];
+                    const glm::vec3 fixed = glm::clamp(glm::round((location - origin) * toFixed), 0.0f, FIXED_MAX);
+                    for(int k = 0; k < 3; k++) {
+                        instance.location[k] = (GLushort) fixed[k];
+                    }
+                    instance.index = i;
+                }
+                else {
+                    SphereInstance& instance = ((SphereInstance*) region)[target];
+                    instance.location = location;
+                    instance.index = i;
+                }
+            }
+        }
+    });
+
+    // Lights keep full precision, and light even what is off screen; the
+    //   shader measures distances to them
+    state.lights.clear();
+    for(GLint index : snapshot.lightSourceIndices) {
+        if((size_t) index < N) {
+            state.lights.push_back(glm::vec4(locationAt(index), snapshot.radius[index]));
+            state.lights.push_back(glm::vec4(snapshot.colors[index], 1.0f));
+        }
+    }
+}
@@ -0,0 +1,185 @@
+#ifndef INSTANCE_WRITER_HPP
+#define INSTANCE_WRITER_HPP
+
+#include <cstdint>
+#include <entity.hpp>
+#include <frustum.hpp>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <particlestore.hpp>
+#include <vector>
+
+// A level of detail is fine enough while each sector spans at most this
+//   many pixels of the sphere's outline on screen
+const float LOD_PIXELS_PER_SECTOR = 4.0f;
+// The compact format is used while its fixed-point step stays below this
+//   fraction of the smallest radius
+const float COMPACT_TOLERANCE = 0.01f;
+const float FIXED_MAX = 65535.0f;
+// Visible instances are sorted front to back into this many depth buckets
+//   per level of detail; everything nearer than the first bucket's start
+//   shares it
+const GLuint DEPTH_BUCKETS = 256;
+const float DEPTH_BUCKET_NEAREST = 1.0f / 64.0f;
+
+/**
+ * How the spheres are drawn: as triangle meshes at a level of detail, as
+ *   camera-facing quads ray-cast against the sphere in the fragment shader,
+ *   or as unlit point sprites for overviews of very many bodies
+ */
+enum class RenderMode
+{
+    Mesh = 0,
+    Impostor,
+    Points
+};
+
+/**
+ * Everything the renderer needs from one physics step, copied out so the
+ *   physics thread can carry on with the next one. The previous locations
+ *   are those of the snapshot before, for interpolation, and equal the
+ *   current ones when the sphere count changed in between.
+ *
+ *   Masses, radii, colors and lights only change on a merge, so a slot
+ *   copies them only when its attributeVersion is behind the physics side.
+*/
+struct PhysicsSnapshot
+{
+    AlignedFloats x, y, z;
+    AlignedFloats previousX, previousY, previousZ;
+    AlignedFloats mass, radius;
+    std::vector<glm::vec3> colors;
+    std::vector<GLint> isLightSource;
+    std::vector<GLint> lightSourceIndices;
+    size_t count = 0;
+    // Bumped on every publish, and on every change to the attributes
+    uint64_t version = 0;
+    uint64_t attributeVersion = 0;
+    // Wall-clock seconds at which the previous and current states were ready
+    double previousTime = 0.0;
+    double time = 0.0;
+};
+
+/**
+ * Per-sphere data that only changes on a merge, kept in a texture buffer of
+ *   its own and uploaded only then. Every sphere is a unit sphere scaled
+ *   uniformly, so the shader derives the transform (and leaves the normals
+ *   alone) from the location and radius.
+*/
+struct SphereAttributes
+{
+    GLuint color; // RGBA8; alpha is 255 for light sources
+    float radius;
+};
+
+/**
+ * What the instance buffer ring carries per sphere each frame. Instances
+ *   are sorted by level of detail, so each carries the index of its sphere
+ *   for the attribute lookup.
+*/
+struct SphereInstance
+{
+    glm::vec3 location;
+    GLuint index;
+};
+
+/**
+ * The same at 12 bytes: the location as 16-bit fixed point within the
+ *   frame's bounding box, padded to keep the index 4-byte aligned
+*/
+struct CompactSphereInstance
+{
+    GLushort location[3];
+    GLushort padding;
+    GLuint index;
+};
+
+/**
+ * What setShaderUniforms and bindInstances upload, built from a snapshot:
+ *   the light sources, as two texels each (location and radius, then color)
+ *   for the fragment shader's texture buffer, and the sphere attributes.
+ *   The locations go straight into the instance buffer instead. Each part
+ *   carries the version it was built from, so the GL side can skip uploads
+ *   that would not change anything.
+*/
+struct RenderState
+{
+    // Instances in the frame's region: only the visible ones when culled
+    //   on the CPU
+    size_t count = 0;
+    std::vector<glm::vec4> lights;
+    uint64_t version = 0;
+    std::vector<SphereAttributes> attributes;
+    uint64_t attributeVersion = 0;
+    // Nothing moved since the last frame, so its instances are drawn again
+    bool reuseInstances = false;
+    // The run of instances drawn at each level of detail
+    GLuint lodFirst[SPHERE_LOD_COUNT] = {};
+    GLuint lodCount[SPHERE_LOD_COUNT] = {};
+    // How the frame is drawn: the configured mode, or point sprites
+    RenderMode mode = RenderMode::Mesh;
+    // Which instance format the frame's region holds, and for the compact
+    //   one the box its fixed-point locations span
+    bool compact = false;
+    glm::vec3 origin = glm::vec3(0.0f);
+    glm::vec3 extent = glm::vec3(1.0f);
+    // The view and projection the frame was culled from, and is to be
+    //   drawn with, and the pixels a unit of radius covers at unit depth
+    glm::mat4 view = glm::mat4(1.0f);
+    glm::mat4 projection = glm::mat4(1.0f);
+    float pixelScale = 1.0f;
+};
+
+
+/**
+ * Box around a snapshot's locations, previous and current, so it holds
+ *   every interpolation between them, and its smallest radius
+ */
+struct InstanceBounds
+{
+    glm::vec3 lower, upper;
+    float minRadius;
+};
+
+/**
+ * Builds a frame's instances from a physics snapshot, apart from the GL
+ *   side: interpolates the locations, culls them to the view frustum, sorts
+ *   them by level of detail and depth, and writes them in the full or the
+ *   compact format to wherever the instance buffer is mapped. It remembers
+ *   what the last frame was built from, so a frame that would come out the
+ *   same reuses the last one's instances instead.
+*/
+class InstanceWriter
+{
+    // What the last written frame was built from
+    uint64_t version;
+    uint64_t snapshotVersion;
+    uint64_t attributeVersion;
+    bool settled;
+    RenderMode mode;
+    glm::mat4 cullView;
+    glm::mat4 cullProjection;
+    float cullPixelScale;
+
+    // Scratch for culling the interpolated instances and sorting them by
+    //   level and depth
+    AlignedFloats interpolatedX, interpolatedY, interpolatedZ;
+    std::vector<unsigned char> visible;
+    std::vector<float> depths;
+    std::vector<GLushort> keys;
+    std::vector<GLuint> sortOffsets;
+
+    glm::vec3 locationAt(size_t i) const;
+
+public:
+    InstanceWriter();
+
+    static InstanceBounds measure(const PhysicsSnapshot& snapshot, size_t count);
+    static GLuint selectLod(const glm::vec3& location, float radius, const glm::mat4& view, float pixelScale);
+    static GLuint depthBucket(float depth);
+
+    void write(RenderState& state, const RenderState& last, const PhysicsSnapshot& snapshot, size_t count, float alpha,
+               bool gpuCulled, void* region);
+};
+
+#endif
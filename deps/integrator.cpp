@@ -0,0 +1,112 @@
+#include <integrator.hpp>
+#include <cmath>
+#include <taskscheduler.hpp>
+
+// Drifts and kicks are memory bound, so they are only split into big blocks
+const size_t UPDATE_GRAIN = 4096;
+
+Integrator::Integrator(IntegrationScheme scheme)
+{
+    setScheme(scheme);
+}
+
+/**
+ * Euler here is the semi-implicit (kick then drift) variant the simulation
+ *   always used. Leapfrog is kick-drift-kick. Yoshida composes three
+ *   leapfrog steps with weights w1, w0, w1 for fourth order.
+ */
+void Integrator::setScheme(IntegrationScheme scheme)
+{
+    Integrator::scheme = scheme;
+    accelerationsCurrent = false;
+    stages.clear();
+    switch(scheme) {
+        case IntegrationScheme::Leapfrog:
+            stages = { {true, 0.5f}, {false, 1.0f}, {true, 0.5f} };
+            break;
+        case IntegrationScheme::Yoshida: {
+            const double cbrt2 = std::cbrt(2.0);
+            const float w1 = 1.0 / (2.0 - cbrt2);
+            const float w0 = -cbrt2 / (2.0 - cbrt2);
+            stages = { {false, 0.5f * w1}, {true, w1}, {false, 0.5f * (w0 + w1)}, {true, w0},
+                       {false, 0.5f * (w0 + w1)}, {true, w1}, {false, 0.5f * w1} };
+            break;
+        }
+        case IntegrationScheme::Hermite:
+            // Not a splitting scheme; nothing to do here
+            break;
+        default:
+            stages = { {true, 1.0f}, {false, 1.0f} };
+    }
+}
+
+IntegrationScheme Integrator::getScheme() const
+{
+    return scheme;
+}
+
+/**
+ * Call after anything outside step() changes positions or masses, such as
+ *   a merge, so the next kick does not reuse stale accelerations.
+ */
+void Integrator::invalidate()
+{
+    accelerationsCurrent = false;
+}
+
+void Integrator::drift(ParticleStore& particles, float dt) const
+{
+    const size_t N = particles.size();
+    float* x = particles.x.data();
+    float* y = particles.y.data();
+    float* z = particles.z.data();
+    const float* vx = particles.vx.data();
+    const float* vy = particles.vy.data();
+    const float* vz = particles.vz.data();
+    TaskScheduler::shared().parallelFor(0, N, UPDATE_GRAIN, [=](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            x[i] += dt * vx[i];
+            y[i] += dt * vy[i];
+            z[i] += dt * vz[i];
+        }
+    });
+}
+
+void Integrator::kick(ParticleStore& particles, float dt) const
+{
+    const size_t N = particles.size();
+    float* vx = particles.vx.data();
+    float* vy = particles.vy.data();
+    float* vz = particles.vz.data();
+    const float* ax = particles.ax.data();
+    const float* ay = particles.ay.data();
+    const float* az = particles.az.data();
+    TaskScheduler::shared().parallelFor(0, N, UPDATE_GRAIN, [=](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            vx[i] += dt * ax[i];
+            vy[i] += dt * ay[i];
+            vz[i] += dt * az[i];
+        }
+    });
+}
+
+/**
+ * Advance by dt. computeAccelerations must fill the store's acceleration
+ *   arrays for its current positions.
+ */
+void Integrator::step(ParticleStore& particles, float dt, const std::function<void()>& computeAccelerations)
+{
+    for(const Stage& stage : stages) {
+        if(stage.kick) {
+            if(!accelerationsCurrent) {
+                computeAccelerations();
+                accelerationsCurrent = true;
+            }
+            kick(particles, stage.weight * dt);
+        }
+        else {
+            drift(particles, stage.weight * dt);
+            accelerationsCurrent = false;
+        }
+    }
+}
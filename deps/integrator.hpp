@@ -0,0 +1,50 @@
+#ifndef INTEGRATOR_HPP
+#define INTEGRATOR_HPP
+
+#include <functional>
+#include <particlestore.hpp>
+#include <vector>
+
+/**
+ * Time integration schemes selectable from the settings dialog
+ */
+enum class IntegrationScheme
+{
+    Euler = 0,
+    Leapfrog,
+    Yoshida,
+    Hermite     // block time steps, run by HermiteIntegrator rather than here
+};
+
+/**
+ * Symplectic splitting integrator. Every scheme is a fixed sequence of
+ *   drifts (x += c v dt) and kicks (v += d a dt), so adding one is a matter
+ *   of adding its coefficients. Accelerations are only recomputed when the
+ *   positions have moved since the last evaluation, which gives leapfrog its
+ *   single force evaluation per step.
+*/
+class Integrator
+{
+    struct Stage {
+        bool kick;
+        float weight;
+    };
+
+    IntegrationScheme scheme;
+    std::vector<Stage> stages;
+    bool accelerationsCurrent;
+
+    void drift(ParticleStore& particles, float dt) const;
+    void kick(ParticleStore& particles, float dt) const;
+
+public:
+    Integrator(IntegrationScheme scheme = IntegrationScheme::Leapfrog);
+
+    void setScheme(IntegrationScheme scheme);
+    IntegrationScheme getScheme() const;
+    void invalidate();
+
+    void step(ParticleStore& particles, float dt, const std::function<void()>& computeAccelerations);
+};
+
+#endif
@@ -0,0 +1,180 @@
+#include <numatopology.hpp>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char* NODE_PATH = "/sys/devices/system/node/node";
+
+// Parse a /sys list such as "0-3,8-11"
+static std::vector<unsigned> parseCpuList(const std::string& list)
+{
+    std::vector<unsigned> cpus;
+    std::stringstream stream(list);
+    std::string range;
+    while(std::getline(stream, range, ',')) {
+        if(range.empty() || range == "\n") {
+            continue;
+        }
+        unsigned first = 0, last = 0;
+        size_t dash = range.find('-');
+        first = std::stoul(range.substr(0, dash));
+        last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+        for(unsigned cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+NumaTopology::NumaTopology()
+{
+    cpuNodes.assign(std::max(std::thread::hardware_concurrency(), 1u), 0);
+    nodeCount = 1;
+#ifdef __linux__
+    for(unsigned node = 0; ; node++) {
+        std::ifstream cpuList(NODE_PATH + std::to_string(node) + "/cpulist");
+        if(!cpuList) {
+            break;
+        }
+        std::string list;
+        std::getline(cpuList, list);
+        for(unsigned cpu : parseCpuList(list)) {
+            if(cpu >= cpuNodes.size()) {
+                cpuNodes.resize(cpu + 1, 0);
+            }
+            cpuNodes[cpu] = node;
+        }
+        nodeCount = node + 1;
+    }
+#endif
+}
+
+const NumaTopology& NumaTopology::system()
+{
+    static NumaTopology topology;
+    return topology;
+}
+
+unsigned NumaTopology::getNodeCount() const
+{
+    return nodeCount;
+}
+
+unsigned NumaTopology::getCpuCount() const
+{
+    return cpuNodes.size();
+}
+
+int NumaTopology::nodeOfCpu(unsigned cpu) const
+{
+    return cpu < cpuNodes.size() ? cpuNodes[cpu] : 0;
+}
+
+std::vector<NumaCounters> NumaTopology::readCounters() const
+{
+    std::vector<NumaCounters> counters(nodeCount, NumaCounters{0, 0});
+#ifdef __linux__
+    for(unsigned node = 0; node < nodeCount; node++) {
+        std::ifstream numastat(NODE_PATH + std::to_string(node) + "/numastat");
+        std::string name;
+        uint64_t value;
+        while(numastat >> name >> value) {
+            if(name == "local_node") {
+                counters[node].localPages = value;
+            }
+            else if(name == "other_node") {
+                counters[node].remotePages = value;
+            }
+        }
+    }
+#endif
+    return counters;
+}
+
+/**
+ * Which node each page of [begin, begin + bytes) currently lives on, counted
+ *   per node. move_pages with no target nodes only queries. Pages that were
+ *   never touched have no node yet and are left out.
+ */
+std::vector<size_t> NumaTopology::pagesPerNode(const void* begin, size_t bytes) const
+{
+    std::vector<size_t> pages(nodeCount, 0);
+#if defined(__linux__) && defined(SYS_move_pages)
+    const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t first = (uintptr_t) begin & ~(pageSize - 1);
+    uintptr_t end = (uintptr_t) begin + bytes;
+    std::vector<void*> addresses;
+    for(uintptr_t page = first; page < end; page += pageSize) {
+        addresses.push_back((void*) page);
+    }
+    std::vector<int> status(addresses.size(), -1);
+    if(syscall(SYS_move_pages, 0, addresses.size(), addresses.data(), nullptr, status.data(), 0) == 0) {
+        for(int node : status) {
+            if(node >= 0 && node < (int) nodeCount) {
+                pages[node]++;
+            }
+        }
+    }
+#else
+    (void) begin;
+    (void) bytes;
+#endif
+    return pages;
+}
+
+/**
+ * Restrict the calling thread to one logical CPU
+ */
+bool pinCurrentThread(unsigned cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void) cpu;
+    return false;
+#endif
+}
+
+static double seconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+NumaReport::NumaReport()
+{
+    previous = NumaTopology::system().readCounters();
+    previousTime = seconds();
+}
+
+void NumaReport::print()
+{
+    const double MB = 1024.0 * 1024.0;
+    std::vector<NumaCounters> current = NumaTopology::system().readCounters();
+    double now = seconds();
+    double elapsed = std::max(now - previousTime, 1e-6);
+#ifdef __linux__
+    const double pageSize = sysconf(_SC_PAGESIZE);
+#else
+    const double pageSize = 4096.0;
+#endif
+    for(size_t node = 0; node < current.size() && node < previous.size(); node++) {
+        double local = (current[node].localPages - previous[node].localPages) * pageSize / MB / elapsed;
+        double remote = (current[node].remotePages - previous[node].remotePages) * pageSize / MB / elapsed;
+        std::cout << "NUMA node " << node << ": local " << local << " MB/s, remote " << remote << " MB/s" << std::endl;
+    }
+    previous = current;
+    previousTime = now;
+}
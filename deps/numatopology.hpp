@@ -0,0 +1,60 @@
+#ifndef NUMA_TOPOLOGY_HPP
+#define NUMA_TOPOLOGY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Per-node page counters from /sys/devices/system/node/node<n>/numastat.
+ *   localPages were allocated on this node for a task running on it,
+ *   remotePages on this node for a task running on another one.
+*/
+struct NumaCounters
+{
+    uint64_t localPages;
+    uint64_t remotePages;
+};
+
+/**
+ * The machine's NUMA layout as Linux reports it under /sys. Elsewhere, or
+ *   when /sys is unavailable, everything is one node and pinning is a no-op.
+*/
+class NumaTopology
+{
+    std::vector<int> cpuNodes;  // node of each logical CPU
+    unsigned nodeCount;
+
+public:
+    NumaTopology();
+
+    // Read once; the layout does not change while we run
+    static const NumaTopology& system();
+
+    unsigned getNodeCount() const;
+    unsigned getCpuCount() const;
+    int nodeOfCpu(unsigned cpu) const;
+
+    std::vector<NumaCounters> readCounters() const;
+    std::vector<size_t> pagesPerNode(const void* begin, size_t bytes) const;
+};
+
+bool pinCurrentThread(unsigned cpu);
+
+/**
+ * Prints how fast each node's counters moved since the previous call, in
+ *   MB/s of pages placed locally and remotely. This is page placement
+ *   traffic rather than DRAM bandwidth, which needs uncore PMU access, but
+ *   remote placement on a node is what first-touch is meant to drive to zero.
+*/
+class NumaReport
+{
+    std::vector<NumaCounters> previous;
+    double previousTime;
+
+public:
+    NumaReport();
+    void print();
+};
+
+#endif
@@ -56,6 +56,71 @@ void ParameterManager::setSphereCount(int count)
     sphereCount = count;
 }
 
+void ParameterManager::setThreadCount(int count)
+{
+    threadCount = count;
+}
+
+void ParameterManager::setPinThreads(bool pinned)
+{
+    pinThreads = pinned;
+}
+
+void ParameterManager::setGravityEngine(GravityEngine engine)
+{
+    gravityEngine = engine;
+}
+
+void ParameterManager::setOpeningAngle(float theta)
+{
+    openingAngle = theta;
+}
+
+void ParameterManager::setQuadrupoleEnabled(bool enabled)
+{
+    quadrupoleEnabled = enabled;
+}
+
+void ParameterManager::setExpansionOrder(int order)
+{
+    expansionOrder = order;
+}
+
+void ParameterManager::setMeshSize(int size)
+{
+    meshSize = size;
+}
+
+void ParameterManager::setShortRangeEnabled(bool enabled)
+{
+    shortRangeEnabled = enabled;
+}
+
+void ParameterManager::setIntegrationScheme(IntegrationScheme scheme)
+{
+    integrationScheme = scheme;
+}
+
+void ParameterManager::setTimeStep(float dt)
+{
+    timeStep = dt;
+}
+
+void ParameterManager::setMaxSubsteps(int count)
+{
+    maxSubsteps = count;
+}
+
+void ParameterManager::setTimeStepAccuracy(float eta)
+{
+    timeStepAccuracy = eta;
+}
+
+void ParameterManager::setRenderMode(RenderMode mode)
+{
+    renderMode = mode;
+}
+
 void ParameterManager::setDensity(float density)
 {
     ParameterManager::density = density;
@@ -96,6 +161,71 @@ int ParameterManager::getSphereCount() const
     return sphereCount;
 }
 
+int ParameterManager::getThreadCount() const
+{
+    return threadCount;
+}
+
+bool ParameterManager::getPinThreads() const
+{
+    return pinThreads;
+}
+
+GravityEngine ParameterManager::getGravityEngine() const
+{
+    return gravityEngine;
+}
+
+float ParameterManager::getOpeningAngle() const
+{
+    return openingAngle;
+}
+
+bool ParameterManager::getQuadrupoleEnabled() const
+{
+    return quadrupoleEnabled;
+}
+
+int ParameterManager::getExpansionOrder() const
+{
+    return expansionOrder;
+}
+
+int ParameterManager::getMeshSize() const
+{
+    return meshSize;
+}
+
+bool ParameterManager::getShortRangeEnabled() const
+{
+    return shortRangeEnabled;
+}
+
+IntegrationScheme ParameterManager::getIntegrationScheme() const
+{
+    return integrationScheme;
+}
+
+float ParameterManager::getTimeStep() const
+{
+    return timeStep;
+}
+
+int ParameterManager::getMaxSubsteps() const
+{
+    return maxSubsteps;
+}
+
+float ParameterManager::getTimeStepAccuracy() const
+{
+    return timeStepAccuracy;
+}
+
+RenderMode ParameterManager::getRenderMode() const
+{
+    return renderMode;
+}
+
 float ParameterManager::getLightFraction() const
 {
     return lightFraction;
@@ -141,5 +271,18 @@ void ParameterManager::printParameters() const
     std::cout << "lightFraction: " << lightFraction << std::endl;
     std::cout << "randSeed: " << randSeed << std::endl;
     std::cout << "sphereCount: " << sphereCount << std::endl;
+    std::cout << "threadCount: " << threadCount << std::endl;
+    std::cout << "pinThreads: " << pinThreads << std::endl;
+    std::cout << "gravityEngine: " << (int) gravityEngine << std::endl;
+    std::cout << "openingAngle: " << openingAngle << std::endl;
+    std::cout << "quadrupole: " << quadrupoleEnabled << std::endl;
+    std::cout << "expansionOrder: " << expansionOrder << std::endl;
+    std::cout << "meshSize: " << meshSize << std::endl;
+    std::cout << "P3M: " << shortRangeEnabled << std::endl;
+    std::cout << "integrator: " << (int) integrationScheme << std::endl;
+    std::cout << "timeStep: " << timeStep << std::endl;
+    std::cout << "maxSubsteps: " << maxSubsteps << std::endl;
+    std::cout << "timeStepAccuracy: " << timeStepAccuracy << std::endl;
+    std::cout << "renderMode: " << (int) renderMode << std::endl;
     std::cout << "fullScreen: " << fullScreenChecked << std::endl;
 }
@@ -1,10 +1,23 @@
 #ifndef PARAMETERMANAGER_H
 #define PARAMETERMANAGER_H
+#include <instancewriter.hpp>
+#include <integrator.hpp>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <qt5/QtWidgets/QWidget>
 
+/**
+ * Force solvers selectable from the settings dialog
+ */
+enum class GravityEngine
+{
+    Direct = 0,
+    BarnesHut,
+    FastMultipole,
+    ParticleMesh
+};
+
 /**
  * @brief The ParameterManager class
  * Singleton class containing the simulation parameters
@@ -34,6 +47,27 @@ class ParameterManager
     int randSeed;
     int sphereCount;
 
+    // Worker threads used by the force computation, and whether they are
+    //   pinned to cores with particles placed on their NUMA nodes
+    int threadCount;
+    bool pinThreads;
+
+    // Force solver and its accuracy controls
+    GravityEngine gravityEngine;
+    float openingAngle;
+    bool quadrupoleEnabled;
+    int expansionOrder;
+    int meshSize;
+    bool shortRangeEnabled;
+
+    // Fixed physics time step and how many of them may run per frame
+    IntegrationScheme integrationScheme;
+    float timeStep;
+    int maxSubsteps;
+    // Aarseth accuracy parameter for the Hermite block steps
+    float timeStepAccuracy;
+
+    RenderMode renderMode;
     bool fullScreenChecked;
 
     QColor ambientColorPalette;
@@ -50,6 +84,19 @@ public:
     void setLocationSD(float);
     void setRandSeed(int);
     void setSphereCount(int);
+    void setThreadCount(int);
+    void setPinThreads(bool);
+    void setGravityEngine(GravityEngine);
+    void setOpeningAngle(float);
+    void setQuadrupoleEnabled(bool);
+    void setExpansionOrder(int);
+    void setMeshSize(int);
+    void setShortRangeEnabled(bool);
+    void setIntegrationScheme(IntegrationScheme);
+    void setTimeStep(float);
+    void setMaxSubsteps(int);
+    void setTimeStepAccuracy(float);
+    void setRenderMode(RenderMode);
     void setSphereDensity(float);
     void setLightFraction(float);
     void setRadiiLower(float);
@@ -74,6 +121,19 @@ public:
     bool getFullscreenChecked() const;
     int   getRandSeed() const;
     int   getSphereCount() const;
+    int   getThreadCount() const;
+    bool  getPinThreads() const;
+    GravityEngine getGravityEngine() const;
+    float getOpeningAngle() const;
+    bool  getQuadrupoleEnabled() const;
+    int   getExpansionOrder() const;
+    int   getMeshSize() const;
+    bool  getShortRangeEnabled() const;
+    IntegrationScheme getIntegrationScheme() const;
+    float getTimeStep() const;
+    int   getMaxSubsteps() const;
+    float getTimeStepAccuracy() const;
+    RenderMode getRenderMode() const;
     QColor getAmbientPalette() const;
 };
 
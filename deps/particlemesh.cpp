@@ -0,0 +1,337 @@
+/**
+ * Particle-mesh solver. The grid is placed over the bounding cube of the
+ *   bodies every step. Because the Green's function only depends on the
+ *   spacing through an overall 1 / h factor, its transform is computed once
+ *   for unit spacing and rescaled, so a step costs one forward and one
+ *   inverse 3D FFT on the padded grid.
+ */
+#include <particlemesh.hpp>
+#include <algorithm>
+#include <cmath>
+#include <taskscheduler.hpp>
+
+// Gaussian split scale r_s in cells, and the short-range cutoff in units of r_s
+const float SPLIT_CELLS = 1.25f;
+const float SHORT_RANGE_CUTOFF = 4.5f;
+
+ParticleMesh::ParticleMesh(int meshSize, bool shortRange)
+{
+    ParticleMesh::meshSize = 0;
+    ParticleMesh::shortRange = shortRange;
+    greenValid = false;
+    spacing = 1.0f;
+    splitRadius = SPLIT_CELLS;
+    setMeshSize(meshSize);
+}
+
+void ParticleMesh::setMeshSize(int meshSize)
+{
+    // Round up to a power of two for the radix-2 FFT
+    int size = 8;
+    while(size < meshSize && size < 512) {
+        size <<= 1;
+    }
+    if(size != ParticleMesh::meshSize) {
+        greenValid = false;
+    }
+    ParticleMesh::meshSize = size;
+}
+
+void ParticleMesh::setShortRange(bool enabled)
+{
+    if(enabled != shortRange) {
+        greenValid = false;
+    }
+    shortRange = enabled;
+}
+
+int ParticleMesh::getMeshSize() const
+{
+    return meshSize;
+}
+
+bool ParticleMesh::getShortRange() const
+{
+    return shortRange;
+}
+
+int ParticleMesh::paddedSize() const
+{
+    return 2 * meshSize;
+}
+
+void ParticleMesh::prepareTables()
+{
+    const int M = paddedSize();
+    int bits = 0;
+    while((1 << bits) < M) {
+        bits++;
+    }
+    bitReverse.resize(M);
+    for(int i = 0; i < M; i++) {
+        int reversed = 0;
+        for(int b = 0; b < bits; b++) {
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        bitReverse[i] = reversed;
+    }
+    twiddles.resize(M / 2);
+    for(int k = 0; k < M / 2; k++) {
+        double angle = -2.0 * M_PI * k / M;
+        twiddles[k] = std::complex<float>(std::cos(angle), std::sin(angle));
+    }
+}
+
+/**
+ * In-place iterative radix-2 Cooley-Tukey on one contiguous line
+ */
+void ParticleMesh::transformLine(std::complex<float>* line) const
+{
+    const int M = paddedSize();
+    for(int i = 0; i < M; i++) {
+        if(i < bitReverse[i]) {
+            std::swap(line[i], line[bitReverse[i]]);
+        }
+    }
+    for(int length = 2; length <= M; length <<= 1) {
+        const int half = length >> 1;
+        const int step = M / length;
+        for(int i = 0; i < M; i += length) {
+            for(int j = 0; j < half; j++) {
+                std::complex<float> u = line[i + j];
+                std::complex<float> v = line[i + j + half] * twiddles[j * step];
+                line[i + j] = u + v;
+                line[i + j + half] = u - v;
+            }
+        }
+    }
+}
+
+/**
+ * Unnormalized 3D FFT, one axis at a time with the lines of each axis split
+ *   over the scheduler's threads. The inverse uses conj(FFT(conj(x))). With sparseInput
+ *   only the first octant is assumed non-zero, which lets the forward pass
+ *   skip the lines that are still all zero.
+ */
+void ParticleMesh::transform(std::vector<std::complex<float>>& grid, bool inverse, bool sparseInput, unsigned nThreads) const
+{
+    const int M = paddedSize();
+    const int N = meshSize;
+    for(int axis = 0; axis < 3; axis++) {
+        const int stride = axis == 0 ? 1 : (axis == 1 ? M : M * M);
+        auto transformLines = [&, axis, stride](size_t first, size_t last) {
+            std::vector<std::complex<float>> line(M);
+            for(int l = first; l < (int) last; l++) {
+                const int a = l % M, b = l / M;
+                // (a, b) are the two coordinates not being transformed
+                if(sparseInput && !inverse && ((axis == 0 && (a >= N || b >= N)) || (axis == 1 && b >= N))) {
+                    continue;
+                }
+                const int base = axis == 0 ? l * M : (axis == 1 ? b * M * M + a : l);
+                for(int i = 0; i < M; i++) {
+                    line[i] = inverse ? std::conj(grid[base + i * stride]) : grid[base + i * stride];
+                }
+                transformLine(line.data());
+                for(int i = 0; i < M; i++) {
+                    grid[base + i * stride] = inverse ? std::conj(line[i]) : line[i];
+                }
+            }
+        };
+        TaskScheduler::shared().parallelFor(0, M * M, stealingGrain(M * M, nThreads, M), transformLines);
+    }
+}
+
+/**
+ * Transform of -1/r on the padded grid for unit spacing, wrapped so that the
+ *   circular convolution equals the linear one over the particle octant.
+ *   With the short-range split the mesh only gets -erf(r / 2r_s) / r.
+ */
+void ParticleMesh::computeGreenTransform(unsigned nThreads)
+{
+    const int M = paddedSize();
+    greenTransform.assign(M * M * M, std::complex<float>(0.0f));
+    for(int k = 0; k < M; k++) {
+        for(int j = 0; j < M; j++) {
+            for(int i = 0; i < M; i++) {
+                glm::vec3 d(std::min(i, M - i), std::min(j, M - j), std::min(k, M - k));
+                float r = glm::length(d);
+                float g;
+                if(shortRange) {
+                    g = r > 0.0f ? -std::erf(r / (2.0f * SPLIT_CELLS)) / r : -1.0f / (SPLIT_CELLS * std::sqrt((float) M_PI));
+                }
+                else {
+                    g = r > 0.0f ? -1.0f / r : -1.0f;
+                }
+                greenTransform[(k * M + j) * M + i] = g;
+            }
+        }
+    }
+    transform(greenTransform, false, false, nThreads);
+    greenValid = true;
+}
+
+/**
+ * Cloud-in-cell deposit into the first octant of the padded grid
+ */
+void ParticleMesh::deposit(const ParticleView& particles)
+{
+    const int M = paddedSize();
+    std::fill(density.begin(), density.end(), std::complex<float>(0.0f));
+    for(size_t p = 0; p < particles.count; p++) {
+        glm::vec3 u = (particles.location(p) - origin) / spacing;
+        glm::ivec3 cell = glm::clamp(glm::ivec3(glm::floor(u)), glm::ivec3(0), glm::ivec3(meshSize - 2));
+        glm::vec3 t = u - glm::vec3(cell);
+        for(int c = 0; c < 8; c++) {
+            glm::ivec3 o(c & 1, (c >> 1) & 1, (c >> 2) & 1);
+            float w = (o.x ? t.x : 1.0f - t.x) * (o.y ? t.y : 1.0f - t.y) * (o.z ? t.z : 1.0f - t.z);
+            glm::ivec3 n = cell + o;
+            density[(n.z * M + n.y) * M + n.x] += particles.mass[p] * w;
+        }
+    }
+}
+
+/**
+ * -grad phi at a body: central differences at the eight surrounding nodes,
+ *   blended with the deposit weights. Node -1 wraps to M - 1, which holds the
+ *   correct isolated potential one cell below the grid.
+ */
+glm::vec3 ParticleMesh::interpolate(const glm::vec3& location) const
+{
+    const int M = paddedSize();
+    auto phi = [this, M](int i, int j, int k) {
+        return density[(((k + M) & (M - 1)) * M + ((j + M) & (M - 1))) * M + ((i + M) & (M - 1))].real();
+    };
+    glm::vec3 u = (location - origin) / spacing;
+    glm::ivec3 cell = glm::clamp(glm::ivec3(glm::floor(u)), glm::ivec3(0), glm::ivec3(meshSize - 2));
+    glm::vec3 t = u - glm::vec3(cell);
+    glm::vec3 acc(0.0f);
+    for(int c = 0; c < 8; c++) {
+        glm::ivec3 o(c & 1, (c >> 1) & 1, (c >> 2) & 1);
+        float w = (o.x ? t.x : 1.0f - t.x) * (o.y ? t.y : 1.0f - t.y) * (o.z ? t.z : 1.0f - t.z);
+        glm::ivec3 n = cell + o;
+        glm::vec3 gradient(phi(n.x + 1, n.y, n.z) - phi(n.x - 1, n.y, n.z),
+                           phi(n.x, n.y + 1, n.z) - phi(n.x, n.y - 1, n.z),
+                           phi(n.x, n.y, n.z + 1) - phi(n.x, n.y, n.z - 1));
+        acc -= w * gradient;
+    }
+    return acc / (2.0f * spacing);
+}
+
+/**
+ * P3M correction: the part of the Gaussian split the mesh left out, summed
+ *   directly over neighbours found through a chaining mesh whose cells are
+ *   at least one cutoff wide.
+ */
+void ParticleMesh::addShortRange(const ParticleView& particles, float G, AccelerationView accelerations,
+                                 unsigned nThreads)
+{
+    const int N = particles.count;
+    const float cutoff = SHORT_RANGE_CUTOFF * splitRadius;
+    const float width = spacing * (meshSize - 1);
+    const int C = std::max(1, std::min((int) (width / cutoff), 256));
+    const float cellSize = std::max(width / C, cutoff);
+
+    auto cellOf = [this, C, cellSize](const glm::vec3& x) {
+        glm::ivec3 c = glm::ivec3(glm::floor((x - origin) / cellSize));
+        return glm::clamp(c, glm::ivec3(0), glm::ivec3(C - 1));
+    };
+    chainHead.assign(C * C * C, -1);
+    chainNext.resize(N);
+    for(int p = 0; p < N; p++) {
+        glm::ivec3 c = cellOf(particles.location(p));
+        int& head = chainHead[(c.z * C + c.y) * C + c.x];
+        chainNext[p] = head;
+        head = p;
+    }
+
+    const float invSqrtPi = 1.0f / std::sqrt((float) M_PI);
+    auto correctRange = [&](int begin, int end) {
+        for(int p = begin; p < end; p++) {
+            glm::ivec3 c = cellOf(particles.location(p));
+            glm::vec3 acc(0.0f);
+            for(int dz = -1; dz <= 1; dz++) {
+                for(int dy = -1; dy <= 1; dy++) {
+                    for(int dx = -1; dx <= 1; dx++) {
+                        glm::ivec3 n = c + glm::ivec3(dx, dy, dz);
+                        if(glm::any(glm::lessThan(n, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(n, glm::ivec3(C)))) {
+                            continue;
+                        }
+                        for(int q = chainHead[(n.z * C + n.y) * C + n.x]; q != -1; q = chainNext[q]) {
+                            glm::vec3 r = particles.location(q) - particles.location(p);
+                            float r2 = glm::dot(r, r);
+                            if(q == p || r2 <= 0.0f || r2 >= cutoff * cutoff) {
+                                continue;
+                            }
+                            float len = std::sqrt(r2);
+                            float x = len / (2.0f * splitRadius);
+                            float factor = std::erfc(x) + 2.0f * x * invSqrtPi * std::exp(-x * x);
+                            acc += particles.mass[q] * factor / (r2 * len) * r;
+                        }
+                    }
+                }
+            }
+            accelerations.set(p, accelerations.get(p) + G * acc);
+        }
+    };
+    TaskScheduler::shared().parallelFor(0, N, stealingGrain(N, nThreads, 64), correctRange);
+}
+
+void ParticleMesh::computeAccelerations(const ParticleView& particles, float G, AccelerationView accelerations,
+                                        unsigned nThreads)
+{
+    const int N = particles.count;
+    if(N == 0) {
+        return;
+    }
+    nThreads = std::max(nThreads, 1u);
+    const int M = paddedSize();
+    if((int) bitReverse.size() != M) {
+        prepareTables();
+        greenValid = false;
+    }
+    density.resize(M * M * M);
+
+    // Place the particle octant over the bounding cube
+    glm::vec3 lower = particles.location(0), upper = particles.location(0);
+    for(int i = 1; i < N; i++) {
+        lower = glm::min(lower, particles.location(i));
+        upper = glm::max(upper, particles.location(i));
+    }
+    glm::vec3 extent = upper - lower;
+    float width = std::max(std::max(extent.x, std::max(extent.y, extent.z)) * 1.0001f, 1e-3f);
+    spacing = width / (meshSize - 1);
+    origin = 0.5f * (lower + upper) - glm::vec3(0.5f * width);
+    splitRadius = SPLIT_CELLS * spacing;
+
+    // The Green's function only depends on the mesh, so when it has to be
+    //   rebuilt that runs alongside the deposit and forward transform
+    TaskGraph graph;
+    std::vector<TaskGraph::TaskId> ready;
+    ready.push_back(graph.add([&]() {
+        deposit(particles);
+        transform(density, false, true, nThreads);
+    }));
+    if(!greenValid) {
+        ready.push_back(graph.add([&]() { computeGreenTransform(nThreads); }));
+    }
+    TaskGraph::TaskId convolved = graph.add([&]() {
+        // The kernel was built for h = 1 and G = 1; the inverse FFT is unnormalized
+        const float scale = G / (spacing * (float) M * M * M);
+        for(size_t k = 0; k < density.size(); k++) {
+            density[k] *= greenTransform[k] * scale;
+        }
+        transform(density, true, false, nThreads);
+    }, ready);
+    graph.add([&]() {
+        TaskScheduler::shared().parallelFor(0, N, stealingGrain(N, nThreads, 64), [&](size_t begin, size_t end) {
+            for(size_t p = begin; p < end; p++) {
+                accelerations.set(p, interpolate(particles.location(p)));
+            }
+        });
+    }, std::vector<TaskGraph::TaskId>(1, convolved));
+    graph.run(TaskScheduler::shared());
+
+    if(shortRange) {
+        addShortRange(particles, G, accelerations, nThreads);
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef PARTICLE_MESH_HPP
+#define PARTICLE_MESH_HPP
+
+#include <complex>
+#include <glm/glm.hpp>
+#include <particlestore.hpp>
+#include <vector>
+
+/**
+ * Particle-mesh gravity solver. Masses are deposited onto a cubic grid with
+ *   cloud-in-cell weights, the potential is found by convolving with the
+ *   Green's function through FFTs on a zero-padded grid (so the boundary is
+ *   isolated rather than periodic), and accelerations are interpolated back
+ *   from the potential gradient with the same weights.
+ *
+ * With the short-range correction (P3M) enabled the mesh only carries the
+ *   long-range part of a Gaussian force split, and pairs closer than a few
+ *   cells are summed directly through a chaining mesh.
+*/
+class ParticleMesh
+{
+    int meshSize;       // cells per side of the particle grid, a power of two
+    bool shortRange;
+
+    // Green's function transform for unit spacing and G; scaled per step
+    std::vector<std::complex<float>> greenTransform;
+    std::vector<std::complex<float>> density;
+    std::vector<std::complex<float>> twiddles;
+    std::vector<int> bitReverse;
+    bool greenValid;
+
+    // Grid placement for the current step
+    glm::vec3 origin;
+    float spacing;
+    float splitRadius;
+
+    // Chaining mesh for the P3M pass
+    std::vector<int> chainHead;
+    std::vector<int> chainNext;
+
+    int paddedSize() const;
+    void prepareTables();
+    void computeGreenTransform(unsigned nThreads);
+    void transform(std::vector<std::complex<float>>& grid, bool inverse, bool sparseInput, unsigned nThreads) const;
+    void transformLine(std::complex<float>* line) const;
+    void deposit(const ParticleView& particles);
+    glm::vec3 interpolate(const glm::vec3& location) const;
+    void addShortRange(const ParticleView& particles, float G, AccelerationView accelerations, unsigned nThreads);
+
+public:
+    ParticleMesh(int meshSize = 64, bool shortRange = true);
+
+    void setMeshSize(int meshSize);
+    void setShortRange(bool enabled);
+    int getMeshSize() const;
+    bool getShortRange() const;
+
+    void computeAccelerations(const ParticleView& particles, float G, AccelerationView accelerations,
+                              unsigned nThreads = 1);
+};
+
+#endif
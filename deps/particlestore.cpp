@@ -0,0 +1,220 @@
+#include <particlestore.hpp>
+#include <algorithm>
+#include <cstdint>
+
+// Padding lanes are parked this far out with zero mass. Far enough to never
+//   matter, close enough that 1/r^3 stays a normal float.
+const float PADDING_DISTANCE = 1e9f;
+
+// Bytes per page, the unit memory is placed on a node in
+const uintptr_t PAGE_BYTES = 4096;
+const size_t PAGE_FLOATS = PAGE_BYTES / sizeof(float);
+
+ParticleStore::ParticleStore()
+{
+    count = 0;
+}
+
+size_t ParticleStore::paddedSize(size_t n)
+{
+    return (n + PARTICLE_SIMD_WIDTH - 1) / PARTICLE_SIMD_WIDTH * PARTICLE_SIMD_WIDTH;
+}
+
+size_t ParticleStore::size() const
+{
+    return count;
+}
+
+void ParticleStore::setPadding(size_t begin, size_t end)
+{
+    for(size_t i = begin; i < end; i++) {
+        x[i] = y[i] = z[i] = PADDING_DISTANCE;
+        vx[i] = vy[i] = vz[i] = 0.0f;
+        ax[i] = ay[i] = az[i] = 0.0f;
+        mass[i] = 0.0f;
+        radius[i] = 0.0f;
+    }
+}
+
+void ParticleStore::clear()
+{
+    resize(0);
+}
+
+/**
+ * Resize every array to the padded length of n and re-pad the tail
+ */
+void ParticleStore::resize(size_t n)
+{
+    const size_t padded = paddedSize(n);
+    AlignedFloats* fields[] = { &x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &mass, &radius };
+    for(AlignedFloats* field : fields) {
+        field->resize(padded, 0.0f);
+    }
+    count = n;
+    setPadding(n, padded);
+}
+
+/**
+ * Reallocate every array and fill it from the scheduler's parallel loop
+ *   over the particles, which with a static partition splits them into the
+ *   same blocks as the force loops. Each page is written first by the block
+ *   its first float falls in, so with pinned workers it lands in the memory
+ *   of the node that will run the force loops on it.
+ */
+void ParticleStore::firstTouch(TaskScheduler& scheduler)
+{
+    AlignedFloats* fields[] = { &x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &mass, &radius };
+    for(AlignedFloats* field : fields) {
+        AlignedFloats placed;
+        placed.resize(field->size());
+        const float* source = field->data();
+        float* target = placed.data();
+        const size_t size = field->size();
+        // First float at or after i that starts a page
+        auto pageStart = [target, size](size_t i) {
+            const uintptr_t offset = (PAGE_BYTES - (uintptr_t) (target + i) % PAGE_BYTES) % PAGE_BYTES;
+            return std::min(i + offset / sizeof(float), size);
+        };
+        // Without a static partition there are no blocks to match, so
+        //   just copy a page per task
+        const size_t n = count;
+        const size_t grain = scheduler.getStaticPartition() ? 1 : PAGE_FLOATS;
+        scheduler.parallelFor(0, n, grain, [source, target, size, n, &pageStart](size_t first, size_t last) {
+            const size_t from = first == 0 ? 0 : pageStart(first);
+            const size_t to = last == n ? size : pageStart(last);
+            if(from < to) {
+                std::copy(source + from, source + to, target + from);
+            }
+        });
+        if(n == 0) {
+            std::copy(source, source + size, target);
+        }
+        field->swap(placed);
+    }
+}
+
+void ParticleStore::push_back(const glm::vec3& location, const glm::vec3& velocity, float mass, float radius)
+{
+    const size_t i = count;
+    if(paddedSize(count + 1) > x.size()) {
+        resize(count + 1);
+    }
+    else {
+        count++;
+    }
+    setLocation(i, location);
+    setVelocity(i, velocity);
+    ax[i] = ay[i] = az[i] = 0.0f;
+    ParticleStore::mass[i] = mass;
+    ParticleStore::radius[i] = radius;
+}
+
+/**
+ * Order-preserving removal, so indices held by the renderer stay in step
+ */
+void ParticleStore::erase(size_t i)
+{
+    if(i >= count) {
+        return;
+    }
+    AlignedFloats* fields[] = { &x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &mass, &radius };
+    for(AlignedFloats* field : fields) {
+        std::copy(field->begin() + i + 1, field->begin() + count, field->begin() + i);
+    }
+    count--;
+    if(paddedSize(count) < x.size()) {
+        resize(count);
+    }
+    else {
+        setPadding(count, count + 1);
+    }
+}
+
+/**
+ * Drop every particle flagged in removed with a single stable pass over
+ *   each array
+ */
+void ParticleStore::compact(const std::vector<char>& removed)
+{
+    size_t kept = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(removed[i]) {
+            continue;
+        }
+        if(kept != i) {
+            x[kept] = x[i];
+            y[kept] = y[i];
+            z[kept] = z[i];
+            vx[kept] = vx[i];
+            vy[kept] = vy[i];
+            vz[kept] = vz[i];
+            ax[kept] = ax[i];
+            ay[kept] = ay[i];
+            az[kept] = az[i];
+            mass[kept] = mass[i];
+            radius[kept] = radius[i];
+        }
+        kept++;
+    }
+    const size_t oldCount = count;
+    count = kept;
+    if(paddedSize(count) < x.size()) {
+        resize(count);
+    }
+    else {
+        setPadding(count, oldCount);
+    }
+}
+
+glm::vec3 ParticleStore::location(size_t i) const
+{
+    return glm::vec3(x[i], y[i], z[i]);
+}
+
+glm::vec3 ParticleStore::velocity(size_t i) const
+{
+    return glm::vec3(vx[i], vy[i], vz[i]);
+}
+
+glm::vec3 ParticleStore::acceleration(size_t i) const
+{
+    return glm::vec3(ax[i], ay[i], az[i]);
+}
+
+void ParticleStore::setLocation(size_t i, const glm::vec3& location)
+{
+    x[i] = location.x;
+    y[i] = location.y;
+    z[i] = location.z;
+}
+
+void ParticleStore::setVelocity(size_t i, const glm::vec3& velocity)
+{
+    vx[i] = velocity.x;
+    vy[i] = velocity.y;
+    vz[i] = velocity.z;
+}
+
+ParticleView ParticleStore::view() const
+{
+    ParticleView view;
+    view.x = x.data();
+    view.y = y.data();
+    view.z = z.data();
+    view.mass = mass.data();
+    view.radius = radius.data();
+    view.count = count;
+    view.paddedCount = x.size();
+    return view;
+}
+
+AccelerationView ParticleStore::accelerations()
+{
+    AccelerationView view;
+    view.x = ax.data();
+    view.y = ay.data();
+    view.z = az.data();
+    view.count = count;
+    return view;
+}
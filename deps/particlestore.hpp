@@ -0,0 +1,153 @@
+#ifndef PARTICLE_STORE_HPP
+#define PARTICLE_STORE_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <glm/glm.hpp>
+#include <new>
+#include <taskscheduler.hpp>
+#include <vector>
+
+// Cache line alignment and the widest SIMD register in floats (AVX-512)
+const size_t PARTICLE_ALIGNMENT = 64;
+const size_t PARTICLE_SIMD_WIDTH = 16;
+
+/**
+ * Minimal allocator handing out PARTICLE_ALIGNMENT-aligned blocks so every
+ *   particle array starts on a cache line and can be loaded with aligned
+ *   vector instructions. resize(n) without a fill value leaves the new
+ *   elements uninitialized, so their pages are first touched, and placed on
+ *   a NUMA node, by whichever thread writes them first.
+*/
+template <typename T>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    AlignedAllocator() {}
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        void* block = nullptr;
+#ifdef _WIN32
+        block = _aligned_malloc(n * sizeof(T), PARTICLE_ALIGNMENT);
+#else
+        if(posix_memalign(&block, PARTICLE_ALIGNMENT, n * sizeof(T)) != 0) {
+            block = nullptr;
+        }
+#endif
+        if(block == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(block);
+    }
+
+    void deallocate(T* block, size_t)
+    {
+#ifdef _WIN32
+        _aligned_free(block);
+#else
+        free(block);
+#endif
+    }
+
+    template <typename U>
+    void construct(U* element)
+    {
+        ::new((void*) element) U;
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+typedef std::vector<float, AlignedAllocator<float>> AlignedFloats;
+
+/**
+ * Read-only window onto the particle arrays. Force kernels, the camera and
+ *   the renderer take this instead of the store, so each of them only
+ *   touches the arrays it actually reads. Entries in [count, paddedCount)
+ *   have zero mass and sit far away, so a SIMD loop may run over them.
+*/
+struct ParticleView
+{
+    const float* x;
+    const float* y;
+    const float* z;
+    const float* mass;
+    const float* radius;
+    size_t count;
+    size_t paddedCount;
+
+    glm::vec3 location(size_t i) const
+    {
+        return glm::vec3(x[i], y[i], z[i]);
+    }
+};
+
+/**
+ * Writable acceleration arrays, same layout as the view
+*/
+struct AccelerationView
+{
+    float* x;
+    float* y;
+    float* z;
+    size_t count;
+
+    glm::vec3 get(size_t i) const
+    {
+        return glm::vec3(x[i], y[i], z[i]);
+    }
+
+    void set(size_t i, const glm::vec3& a)
+    {
+        x[i] = a.x;
+        y[i] = a.y;
+        z[i] = a.z;
+    }
+};
+
+/**
+ * Structure-of-arrays particle storage. Each field lives in its own aligned
+ *   array, padded up to a multiple of PARTICLE_SIMD_WIDTH.
+*/
+class ParticleStore
+{
+    size_t count;
+
+    void setPadding(size_t begin, size_t end);
+
+public:
+    AlignedFloats x, y, z;
+    AlignedFloats vx, vy, vz;
+    AlignedFloats ax, ay, az;
+    AlignedFloats mass, radius;
+
+    ParticleStore();
+
+    static size_t paddedSize(size_t n);
+
+    size_t size() const;
+    void clear();
+    void push_back(const glm::vec3& location, const glm::vec3& velocity, float mass, float radius);
+    void erase(size_t i);
+    void compact(const std::vector<char>& removed);
+    void resize(size_t n);
+    void firstTouch(TaskScheduler& scheduler);
+
+    glm::vec3 location(size_t i) const;
+    glm::vec3 velocity(size_t i) const;
+    glm::vec3 acceleration(size_t i) const;
+    void setLocation(size_t i, const glm::vec3& location);
+    void setVelocity(size_t i, const glm::vec3& velocity);
+
+    ParticleView view() const;
+    AccelerationView accelerations();
+};
+
+#endif
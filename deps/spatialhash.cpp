@@ -0,0 +1,162 @@
+#include <spatialhash.hpp>
+#include <algorithm>
+#include <cmath>
+#include <taskscheduler.hpp>
+
+// Cell coordinates are clamped here so far-flung bodies cannot overflow
+const float MAX_CELL_COORDINATE = 1e9f;
+
+/**
+ * Run body(blockIndex, begin, end) over [0, N) split into nBlocks blocks on
+ *   the shared scheduler. Each block has its own scratch, indexed by
+ *   blockIndex, so the split is fixed rather than left to stealing.
+ */
+template <typename Body>
+static void parallelBlocks(unsigned N, unsigned nBlocks, Body body)
+{
+    const unsigned chunk = (N + nBlocks - 1) / nBlocks;
+    TaskScheduler::shared().parallelFor(0, nBlocks, 1, [&](size_t first, size_t last) {
+        for(unsigned t = first; t < last; t++) {
+            body(t, std::min(t * chunk, N), std::min((t + 1) * chunk, N));
+        }
+    });
+}
+
+SpatialHash::SpatialHash()
+{
+    cellSize = 1.0f;
+    tableMask = 0;
+}
+
+float SpatialHash::getCellSize() const
+{
+    return cellSize;
+}
+
+glm::ivec3 SpatialHash::cellOf(const glm::vec3& location) const
+{
+    glm::vec3 cell = glm::floor(location / cellSize);
+    return glm::ivec3(glm::clamp(cell, glm::vec3(-MAX_CELL_COORDINATE), glm::vec3(MAX_CELL_COORDINATE)));
+}
+
+unsigned SpatialHash::hashCell(const glm::ivec3& cell) const
+{
+    return ((unsigned) cell.x * 73856093u ^ (unsigned) cell.y * 19349663u ^ (unsigned) cell.z * 83492791u) & tableMask;
+}
+
+/**
+ * Counting sort of the particles by bucket. Each thread histograms its own
+ *   block, the histograms are scanned bucket-major so every thread gets its
+ *   own write offsets, and the scatter then runs without any atomics.
+ */
+void SpatialHash::build(const ParticleView& particles, unsigned nThreads)
+{
+    const unsigned N = particles.count;
+    float maxRadius = 0.0f;
+    for(unsigned i = 0; i < N; i++) {
+        maxRadius = std::max(maxRadius, particles.radius[i]);
+    }
+    cellSize = std::max(2.0f * maxRadius, 1e-6f);
+
+    unsigned tableSize = 1;
+    while(tableSize < 2 * N) {
+        tableSize <<= 1;
+    }
+    tableMask = tableSize - 1;
+    bucketOf.resize(N);
+    sorted.resize(N);
+    bucketStart.resize(tableSize + 1);
+    threadCounts.assign((size_t) nThreads * tableSize, 0);
+
+    parallelBlocks(N, nThreads, [&](unsigned t, unsigned begin, unsigned end) {
+        unsigned* counts = &threadCounts[(size_t) t * tableSize];
+        for(unsigned i = begin; i < end; i++) {
+            bucketOf[i] = hashCell(cellOf(particles.location(i)));
+            counts[bucketOf[i]]++;
+        }
+    });
+
+    unsigned offset = 0;
+    for(unsigned b = 0; b < tableSize; b++) {
+        bucketStart[b] = offset;
+        for(unsigned t = 0; t < nThreads; t++) {
+            unsigned count = threadCounts[(size_t) t * tableSize + b];
+            threadCounts[(size_t) t * tableSize + b] = offset;
+            offset += count;
+        }
+    }
+    bucketStart[tableSize] = offset;
+
+    parallelBlocks(N, nThreads, [&](unsigned t, unsigned begin, unsigned end) {
+        unsigned* offsets = &threadCounts[(size_t) t * tableSize];
+        for(unsigned i = begin; i < end; i++) {
+            sorted[offsets[bucketOf[i]]++] = i;
+        }
+    });
+}
+
+/**
+ * Narrow-phase for one block of particles. Each particle looks at the 27
+ *   cells around it and keeps only partners with a higher index, so every
+ *   pair is reported once. Distinct cells can hash to the same bucket, so
+ *   buckets are deduplicated before they are scanned.
+ */
+void SpatialHash::query(const ParticleView& particles, unsigned threadIndex, unsigned begin, unsigned end)
+{
+    std::vector<ContactPair>& found = threadContacts[threadIndex];
+    found.clear();
+    unsigned buckets[27];
+    for(unsigned i = begin; i < end; i++) {
+        const glm::vec3 x = particles.location(i);
+        const glm::ivec3 cell = cellOf(x);
+        int bucketCount = 0;
+        for(int dz = -1; dz <= 1; dz++) {
+            for(int dy = -1; dy <= 1; dy++) {
+                for(int dx = -1; dx <= 1; dx++) {
+                    unsigned b = hashCell(cell + glm::ivec3(dx, dy, dz));
+                    if(std::find(buckets, buckets + bucketCount, b) == buckets + bucketCount) {
+                        buckets[bucketCount++] = b;
+                    }
+                }
+            }
+        }
+        for(int n = 0; n < bucketCount; n++) {
+            for(unsigned k = bucketStart[buckets[n]]; k < bucketStart[buckets[n] + 1]; k++) {
+                const unsigned j = sorted[k];
+                if(j <= i) {
+                    continue;
+                }
+                glm::vec3 d = particles.location(j) - x;
+                float s = particles.radius[i] + particles.radius[j];
+                if(glm::dot(d, d) <= s * s) {
+                    found.push_back(ContactPair(i, j));
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Rebuild the grid and return every overlapping pair (i, j) with i < j,
+ *   sorted. The returned list is owned by the hash and reused next call.
+ */
+const std::vector<ContactPair>& SpatialHash::findContacts(const ParticleView& particles, unsigned nThreads)
+{
+    const unsigned N = particles.count;
+    contacts.clear();
+    if(N < 2) {
+        return contacts;
+    }
+    nThreads = std::max(std::min(nThreads, N / 256), 1u);
+    build(particles, nThreads);
+
+    threadContacts.resize(nThreads);
+    parallelBlocks(N, nThreads, [&](unsigned t, unsigned begin, unsigned end) {
+        query(particles, t, begin, end);
+    });
+    for(unsigned t = 0; t < nThreads; t++) {
+        contacts.insert(contacts.end(), threadContacts[t].begin(), threadContacts[t].end());
+    }
+    std::sort(contacts.begin(), contacts.end());
+    return contacts;
+}
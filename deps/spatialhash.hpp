@@ -0,0 +1,42 @@
+#ifndef SPATIAL_HASH_HPP
+#define SPATIAL_HASH_HPP
+
+#include <particlestore.hpp>
+#include <utility>
+#include <vector>
+
+typedef std::pair<unsigned, unsigned> ContactPair;
+
+/**
+ * Uniform hash grid broad-phase for sphere contacts. Cells are as wide as
+ *   the largest sphere's diameter, so two spheres can only overlap if they
+ *   sit in the same or adjacent cells. Cells are hashed into a table twice
+ *   the size of the particle count, which keeps memory bounded however far
+ *   the bodies spread out. The grid is rebuilt every step with a parallel
+ *   counting sort.
+*/
+class SpatialHash
+{
+    float cellSize;
+    unsigned tableMask;
+
+    std::vector<unsigned> bucketOf;     // bucket of every particle
+    std::vector<unsigned> bucketStart;  // offsets into sorted, one per bucket plus one
+    std::vector<unsigned> sorted;       // particle indices grouped by bucket
+    std::vector<unsigned> threadCounts; // per-thread histograms for the sort
+    std::vector<std::vector<ContactPair>> threadContacts;
+    std::vector<ContactPair> contacts;
+
+    glm::ivec3 cellOf(const glm::vec3& location) const;
+    unsigned hashCell(const glm::ivec3& cell) const;
+    void build(const ParticleView& particles, unsigned nThreads);
+    void query(const ParticleView& particles, unsigned threadIndex, unsigned begin, unsigned end);
+
+public:
+    SpatialHash();
+
+    float getCellSize() const;
+    const std::vector<ContactPair>& findContacts(const ParticleView& particles, unsigned nThreads = 1);
+};
+
+#endif
@@ -8,9 +8,7 @@ Sphere::Sphere()
 {
     radius = 1;
     color = glm::vec3(1.0);
-    rings = 80, sectors = 80;
-    createVertices();
-    createIndices();
+    createLods();
 }
 
 Sphere::Sphere(float radius, const glm::vec3& color)
@@ -24,10 +22,27 @@ Sphere::Sphere(float radius, const glm::vec3& color)
     }
     Sphere::color = color;
 
-    // TODO: Decide if this is fine for most radii
-    rings = 80, sectors = 80;
-    createVertices();
-    createIndices();
+    createLods();
+}
+
+/**
+ * Append every level of detail, finest first
+ */
+void Sphere::createLods()
+{
+    lods.clear();
+    for(GLuint level = 0; level < SPHERE_LOD_COUNT; level++) {
+        rings = sectors = SPHERE_LOD_RESOLUTIONS[level];
+        const GLuint firstIndex = indices.size();
+        createVertices();
+        createIndices();
+        lods.push_back(SphereLod{ rings, firstIndex, (GLuint) indices.size() - firstIndex });
+    }
+}
+
+const std::vector<SphereLod>& Sphere::getLods() const
+{
+    return lods;
 }
 
 void Sphere::createVertices() 
@@ -55,17 +70,21 @@ void Sphere::createVertices()
     }
 }
 
+/**
+ * Indices for the vertices createVertices just appended
+ */
 void Sphere::createIndices()
 {
+    const GLuint base = vertices.size() / 6 - rings * sectors;
     for(GLuint r = 0; r < rings - 1; r++) {
         for(GLuint s = 0; s < sectors - 1; s++) {
-            indices.push_back(r * sectors + s);       // Current point
-            indices.push_back(r * sectors + s + 1);   // Next point in the same row
-            indices.push_back((r + 1) * sectors + s); // Corresponding point in the next row
+            indices.push_back(base + r * sectors + s);       // Current point
+            indices.push_back(base + r * sectors + s + 1);   // Next point in the same row
+            indices.push_back(base + (r + 1) * sectors + s); // Corresponding point in the next row
 
-            indices.push_back(r * sectors + s + 1);
-            indices.push_back((r + 1) * sectors + s + 1);
-            indices.push_back((r + 1) * sectors + s);
+            indices.push_back(base + r * sectors + s + 1);
+            indices.push_back(base + (r + 1) * sectors + s + 1);
+            indices.push_back(base + (r + 1) * sectors + s);
         }
     }
 }
\ No newline at end of file
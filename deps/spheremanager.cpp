@@ -2,6 +2,17 @@
 
 #define LARGE_SPHER
 
+// How often the FMM force error is sampled against direct summation
+const GLuint FMM_ERROR_INTERVAL = 600;
+const int FMM_ERROR_SAMPLES = 64;
+// How often the per-node counters are printed when threads are pinned
+const GLuint NUMA_REPORT_INTERVAL = 600;
+// Attribute locations of the instanced location and sphere index
+const GLuint LOCATION_ATTRIBUTE = 2;
+const GLuint INDEX_ATTRIBUTE = 3;
+// From this many spheres on, point sprites are drawn unless toggled off
+const GLuint POINT_SPRITE_THRESHOLD = 200000;
+
 template <typename MatType, GLuint N>
 void printMatrix(MatType& matrix)
 {
@@ -37,9 +48,21 @@ std::vector<std::uniform_real_distribution<float>> getColorDistribution(float rl
  * #############
 */
 
-SphereManager::SphereManager(const char* vertexPath, const char* fragmentPath)
+// Wall-clock seconds on the clock the snapshots are stamped with
+static double wallClock()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SphereManager::SphereManager(const char* vertexPath, const char* impostorVertexPath, const char* fragmentPath,
+                             const char* pointVertexPath, const char* pointFragmentPath, const char* cullComputePath)
+    : vertexPath(vertexPath), impostorVertexPath(impostorVertexPath), fragmentPath(fragmentPath),
+      pointVertexPath(pointVertexPath), pointFragmentPath(pointFragmentPath), cullComputePath(cullComputePath),
+      renderMode(RenderMode::Mesh),
+      pointSprites(false), attributeVersion(0), publishVersion(0), publishedCount(0), publishedTime(0.0), physicsRunning(false),
+      physicsPaused(true), instances{}, compactInstances(false), lastRenderSlot(0), uploadedLightVersion(0),
+      uploadedAttributeVersion(0), instanceOffset(0), instanceCapacity(0)
 {
-    shader.setShaderPaths(vertexPath, fragmentPath);
     generateBuffers();
     bindVertexArray();
     bindEBO();
@@ -51,7 +74,10 @@ SphereManager::SphereManager(const char* vertexPath, const char* fragmentPath)
 
 // Destructor
 
-SphereManager::~SphereManager() {}
+SphereManager::~SphereManager()
+{
+    stopPhysics();
+}
 
 
 void SphereManager::bindVertexArray()
@@ -81,6 +107,12 @@ void SphereManager::deleteBuffers()
     glDeleteBuffers(1, &VBO);
     glDeleteBuffers(1, &EBO);
     glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &lightBuffer);
+    glDeleteTextures(1, &lightTexture);
+    glDeleteBuffers(1, &attributeBuffer);
+    glDeleteTextures(1, &attributeTexture);
+    instanceBuffer.remove();
+    gpuCuller.remove();
 }
 
 
@@ -89,6 +121,27 @@ void SphereManager::generateBuffers()
     glGenBuffers(1, &VBO);
     glGenBuffers(1, &EBO);
     glGenVertexArrays(1, &VAO);
+    instanceBuffer.generate();
+    gpuCuller.generate(cullComputePath, sphere.getLods());
+
+    // The light sources are read through a texture buffer, which follows the
+    //   buffer's storage when it is reallocated
+    glGenBuffers(1, &lightBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4), nullptr, GL_STREAM_DRAW);
+    glGenTextures(1, &lightTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightBuffer);
+
+    // So are the sphere attributes, looked up by index since the instances
+    //   are sorted by level of detail: packed color and radius bits
+    glGenBuffers(1, &attributeBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, attributeBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(SphereAttributes), nullptr, GL_DYNAMIC_DRAW);
+    glGenTextures(1, &attributeTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, attributeTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, attributeBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
 }
 
 void SphereManager::enableAttributes()
@@ -99,6 +152,14 @@ void SphereManager::enableAttributes()
 
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride * sizeof(float), (void *) (3 * sizeof(float)));
+
+    // A location and sphere index per instance; the pointers move with the
+    //   instance buffer's region, format and level of detail in drawInstances
+    const GLuint instanceAttributes[] = { LOCATION_ATTRIBUTE, INDEX_ATTRIBUTE };
+    for(GLuint attribute : instanceAttributes) {
+        glEnableVertexAttribArray(attribute);
+        glVertexAttribDivisor(attribute, 1);
+    }
 }
 
 
@@ -108,6 +169,36 @@ void SphereManager::initializeSpheres(std::default_random_engine& randEngine, Pa
     GLuint N = paramManager.getSphereCount();
     G = paramManager.getGravitationalConstant();
     density = paramManager.getDensity();
+    threadCount = std::max(paramManager.getThreadCount(), 1);
+    pinThreads = paramManager.getPinThreads();
+    numaReportStep = 0;
+    // Physics is not running yet, so the pool can be reconfigured
+    TaskScheduler& scheduler = TaskScheduler::shared();
+    scheduler.setThreadCount(threadCount);
+    scheduler.setPinned(pinThreads);
+    scheduler.setStaticPartition(pinThreads);
+    engine = paramManager.getGravityEngine();
+    barnesHut.setTheta(paramManager.getOpeningAngle());
+    barnesHut.setQuadrupole(paramManager.getQuadrupoleEnabled());
+    fastMultipole.setOrder(paramManager.getExpansionOrder());
+    fastMultipole.setTheta(paramManager.getOpeningAngle());
+    particleMesh.setMeshSize(paramManager.getMeshSize());
+    particleMesh.setShortRange(paramManager.getShortRangeEnabled());
+    integrator.setScheme(paramManager.getIntegrationScheme());
+    hermite.setAccuracy(paramManager.getTimeStepAccuracy());
+    hermite.invalidate();
+    timeStep = paramManager.getTimeStep();
+    maxSubsteps = std::max(paramManager.getMaxSubsteps(), 1);
+    stepCount = 0;
+    // Point sprites chosen outright are the same as asking for meshes with
+    //   the sprites switched on
+    renderMode = paramManager.getRenderMode();
+    pointSprites = renderMode == RenderMode::Points || N >= POINT_SPRITE_THRESHOLD;
+    if(renderMode == RenderMode::Points) {
+        renderMode = RenderMode::Mesh;
+    }
+    std::cout << "Direct summation kernel: " << simdLevelName(directKernel.getLevel()) << std::endl;
+    std::cout << "Sphere rendering: " << (pointSprites ? "point sprites" : renderMode == RenderMode::Impostor ? "ray-cast impostors" : "meshes") << std::endl;
 
     QColor ambientColorQ = paramManager.getAmbientPalette();
     int r, g, b, alpha;
@@ -132,24 +223,25 @@ void SphereManager::initializeSpheres(std::default_random_engine& randEngine, Pa
         0.8, 1.0
     );
     GLuint i, j;
-    float theta, phi;
+    float theta, phi, radius;
+    glm::vec3 location, velocity;
+    particles.clear();
     for(i = 0; i < N; i++) {
         isLightSource.push_back(light_dist(randEngine) <= paramManager.getLightFraction());
         theta = theta_dist(randEngine);
         phi = phi_dist(randEngine);
 #ifdef LARGE_SPHERE
-        locations.push_back(paramManager.getLocationSD() * glm::vec3(cos(theta) * sin(phi), sin(theta) * sin(phi), cos(phi)));
+        location = paramManager.getLocationSD() * glm::vec3(cos(theta) * sin(phi), sin(theta) * sin(phi), cos(phi));
 #else
-        locations.push_back(glm::vec3(0.0));
+        location = glm::vec3(0.0);
 #endif
         theta = theta_dist(randEngine);
         phi = phi_dist(randEngine);
-        velocities.push_back(velocities_dist(randEngine) * glm::vec3(cos(theta) * sin(phi), sin(theta) * sin(phi), cos(phi)));
-        accelerations.push_back(glm::vec3(0.0));
+        velocity = velocities_dist(randEngine) * glm::vec3(cos(theta) * sin(phi), sin(theta) * sin(phi), cos(phi));
         colors.push_back(glm::vec3(0.0));
         for(j = 0; j < 3; j++) {
 #ifndef LARGE_SPHERE
-            locations[i][j] = locations_dist(randEngine);
+            location[j] = locations_dist(randEngine);
 #endif
             if(isLightSource[i]) {
                 colors[i][j] = 1;
@@ -158,127 +250,537 @@ void SphereManager::initializeSpheres(std::default_random_engine& randEngine, Pa
                 colors[i][j] = color_dist[j](randEngine);
             }
         }
-        radii.push_back(isLightSource[i] ? paramManager.getSunScale() * radii_dist(randEngine) : radii_dist(randEngine));
-        models.push_back(glm::translate(glm::mat4(1.0), locations[i]));
-        models[i] = glm::scale(models[i], glm::vec3(radii[i]));
-        normals.push_back(glm::mat3(glm::transpose(glm::inverse(models[i]))));
-        masses.push_back(4.0 * pow(radii[i], 3) * M_PI / 3.0 * density);
+        radius = isLightSource[i] ? paramManager.getSunScale() * radii_dist(randEngine) : radii_dist(randEngine);
+        particles.push_back(location, velocity, 4.0 * pow(radius, 3) * M_PI / 3.0 * density, radius);
         if(isLightSource[i]) {
             lightSourceIndices.push_back(i);
         }
     }
-    // Shader initialization can only occur once the number of spheres is known
-    initializeShader(N);
+    if(pinThreads) {
+        particles.firstTouch(scheduler);
+        reportParticlePlacement();
+    }
+    publishedCount = 0;
+    attributeVersion++;
+    publishSnapshot();
+    // Spheres only ever merge, so the first frame needs the most room
+    instanceCapacity = N;
+    instanceBuffer.reserve(N * sizeof(SphereInstance));
+    for(unsigned slot = 0; slot < RENDER_STATE_COUNT; slot++) {
+        instances[slot] = instanceBuffer.map(slot);
+    }
+    updateRenderState();
+    initializeShader();
 }
 
 /**
  * @brief SphereManager::setShaderUniforms
- * This just needs the view and the projection matrices, and it will set all
- *   the rest of the instanced model matrices.
+ * This just needs the view and the projection matrices, and it will set the
+ *   rest of the uniforms and the light sources from the given render state,
+ *   on the program the state is drawn with (which it binds).
+ */
+void SphereManager::setShaderUniforms(glm::mat4& view, glm::mat4& projection, unsigned slot)
+{
+    RenderState& state = renderStates[slot % RENDER_STATE_COUNT];
+    Shader& active = state.mode == RenderMode::Points ? pointShader : shader;
+    useShader(slot);
+    active.setTransform("projection", projection);
+    active.setTransform("view", view);
+    // Orphan the old storage rather than wait for the last frame's draw, and
+    //   only when the lights moved
+    if(state.version != uploadedLightVersion) {
+        glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, std::max(state.lights.size(), (size_t) 1) * sizeof(glm::vec4), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, state.lights.size() * sizeof(glm::vec4), state.lights.data());
+        uploadedLightVersion = state.version;
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, attributeTexture);
+    active.setInt("lights", 0);
+    active.setInt("sphereAttributes", 1);
+    active.setInt("remainingLights", (int) state.lights.size() / 2);
+    active.setVec3("instanceOrigin", state.origin);
+    active.setVec3("instanceExtent", state.extent);
+    active.setVec3("ambientColor", ambientColor);
+    active.setFloat("pointScale", state.pixelScale);
+}
+
+/**
+ * @brief SphereManager::bindInstances
+ * Upload the slot's sphere attributes if they changed, then unmap the
+ *   region updateRenderState filled for the slot, or fall back to the last
+ *   one if nothing moved, for drawInstances to draw from.
+ */
+void SphereManager::bindInstances(unsigned slot)
+{
+    const RenderState& state = renderStates[slot % RENDER_STATE_COUNT];
+    if(state.attributeVersion != uploadedAttributeVersion) {
+        glBindBuffer(GL_TEXTURE_BUFFER, attributeBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, std::max(state.attributes.size(), (size_t) 1) * sizeof(SphereAttributes), nullptr, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, state.attributes.size() * sizeof(SphereAttributes), state.attributes.data());
+        uploadedAttributeVersion = state.attributeVersion;
+    }
+    const GLsizeiptr stride = state.compact ? sizeof(CompactSphereInstance) : sizeof(SphereInstance);
+    instanceOffset = state.reuseInstances ? instanceBuffer.reuse()
+                                          : instanceBuffer.unmap(slot % RENDER_STATE_COUNT, state.count * stride);
+}
+
+/**
+ * @brief SphereManager::cullInstances
+ * Call after bindInstances: where meshes are culled on the GPU, run the
+ *   cull over the slot's instances from the given viewpoint
  */
-void SphereManager::setShaderUniforms(glm::mat4& view, glm::mat4& projection)
-{
-    shader.setTransform("projection", projection);
-    shader.setTransform("view", view);
-    shader.setVec3Array("modelColors", colors.data(), colors.size());
-    shader.setVec3Array("locations", locations.data(), locations.size());
-    shader.setMat4Array("models", models.data(), models.size());
-    shader.setMat3Array("normals", normals.data(), normals.size());
-    shader.setIntArray("isLightSource", isLightSource.data(), isLightSource.size());
-    shader.setIntArray("lightSourceIndices", lightSourceIndices.data(), lightSourceIndices.size());
-    shader.setFloatArray("radii", radii.data(), radii.size());
-    shader.setInt("remainingLights", (int) lightSourceIndices.size());
-    shader.setVec3("ambientColor", ambientColor);
-}
-
-void SphereManager::initializeShader(GLuint N)
-{
-    std::map<std::string, std::string> shaderMacroMap {
-        std::make_pair("__NUM_ENTITIES__", std::to_string(N)),
-        std::make_pair("__NUM_LIGHT_SOURCES__", std::to_string(lightSourceIndices.size()))
-    };
-    shader.setPlaceholders(shaderMacroMap);
+void SphereManager::cullInstances(const glm::mat4& view, const glm::mat4& projection, unsigned slot)
+{
+    const RenderState& state = renderStates[slot % RENDER_STATE_COUNT];
+    if(state.mode != RenderMode::Mesh || !gpuCuller.isSupported()) {
+        return;
+    }
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, attributeTexture);
+    const float lodSectorScale = 2.0f * M_PI * state.pixelScale / LOD_PIXELS_PER_SECTOR;
+    gpuCuller.cull(instanceBuffer.getBuffer(), instanceOffset, state.count, state.compact, state.origin, state.extent,
+                   view, projection, lodSectorScale);
+}
+
+/**
+ * @brief SphereManager::pointInstanceAttributes
+ * Point the instance attributes at the run of instances starting at the
+ *   given byte offset of the instance buffer, in the slot's format
+ */
+void SphereManager::pointInstanceAttributes(const RenderState& state, GLintptr first)
+{
+    if(state.compact) {
+        const GLsizei stride = sizeof(CompactSphereInstance);
+        glVertexAttribPointer(LOCATION_ATTRIBUTE, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+                              (void *) (first + offsetof(CompactSphereInstance, location)));
+        glVertexAttribIPointer(INDEX_ATTRIBUTE, 1, GL_UNSIGNED_INT, stride,
+                               (void *) (first + offsetof(CompactSphereInstance, index)));
+    }
+    else {
+        const GLsizei stride = sizeof(SphereInstance);
+        glVertexAttribPointer(LOCATION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, stride,
+                              (void *) (first + offsetof(SphereInstance, location)));
+        glVertexAttribIPointer(INDEX_ATTRIBUTE, 1, GL_UNSIGNED_INT, stride,
+                               (void *) (first + offsetof(SphereInstance, index)));
+    }
+}
+
+/**
+ * @brief SphereManager::drawInstances
+ * One instanced draw per level of detail, each pointing the instance
+ *   attributes at its own run of the region. Impostors are a single draw
+ *   of a 4-vertex strip per sphere, point sprites one of a point each,
+ *   and meshes culled on the GPU one multi-draw of what cullInstances left.
+ *   Call with the VAO bound and the shader in use, after bindInstances.
+ */
+void SphereManager::drawInstances(unsigned slot)
+{
+    const RenderState& state = renderStates[slot % RENDER_STATE_COUNT];
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer.getBuffer());
+    if(state.mode == RenderMode::Points) {
+        // Opaque bodies replace what is behind them. Light sources add to
+        //   it in a second pass without depth writes, so overlapping glows
+        //   all show whatever order they are drawn in.
+        pointInstanceAttributes(state, instanceOffset);
+        glEnable(GL_PROGRAM_POINT_SIZE);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        pointShader.setBool("glowPass", false);
+        glDrawArraysInstanced(GL_POINTS, 0, 1, state.count);
+        if(!state.lights.empty()) {
+            glDepthMask(GL_FALSE);
+            pointShader.setBool("glowPass", true);
+            glDrawArraysInstanced(GL_POINTS, 0, 1, state.count);
+            glDepthMask(GL_TRUE);
+        }
+        glDisable(GL_BLEND);
+        glDisable(GL_PROGRAM_POINT_SIZE);
+        return;
+    }
+    if(state.mode == RenderMode::Impostor) {
+        pointInstanceAttributes(state, instanceOffset);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, state.count);
+        return;
+    }
+    if(gpuCuller.isSupported()) {
+        glBindBuffer(GL_ARRAY_BUFFER, gpuCuller.getCulledBuffer());
+        pointInstanceAttributes(state, 0);
+        gpuCuller.draw();
+        return;
+    }
+    const std::vector<SphereLod>& lods = sphere.getLods();
+    const GLsizei stride = state.compact ? sizeof(CompactSphereInstance) : sizeof(SphereInstance);
+    for(GLuint level = 0; level < SPHERE_LOD_COUNT; level++) {
+        if(state.lodCount[level] == 0) {
+            continue;
+        }
+        pointInstanceAttributes(state, instanceOffset + (GLintptr) state.lodFirst[level] * stride);
+        glDrawElementsInstanced(GL_TRIANGLES, lods[level].indexCount, GL_UNSIGNED_INT,
+                                (void *) (lods[level].firstIndex * sizeof(GLuint)), state.lodCount[level]);
+    }
+}
+
+/**
+ * @brief SphereManager::fenceInstances
+ * Call after the draw: fence the region just drawn from and map a new one
+ *   for the slot, so the updateRenderState two frames on can fill it. The
+ *   other slot's region is already mapped, so the next frame fills it on a
+ *   worker while this one is still being submitted.
+ */
+void SphereManager::fenceInstances(unsigned slot)
+{
+    instanceBuffer.fence();
+    instances[slot % RENDER_STATE_COUNT] = instanceBuffer.map(slot % RENDER_STATE_COUNT);
+}
+
+/**
+ * @brief SphereManager::takeAverageFenceStall
+ * Seconds the render thread waited, per frame, for the GPU to release an
+ *   instance region since the last call
+ */
+double SphereManager::takeAverageFenceStall()
+{
+    return instanceBuffer.takeAverageStall();
+}
+
+/**
+ * @brief SphereManager::initializeShader
+ * Nothing in the shaders depends on the sphere or light count, so they are
+ *   compiled once whatever N is; only the render mode picks the vertex
+ *   shader and switches the fragment shader's ray cast on or off
+ */
+void SphereManager::initializeShader()
+{
+    const bool impostors = renderMode == RenderMode::Impostor;
+    std::map<std::string, std::string> placeholders = {{ "IMPOSTOR_MODE", impostors ? "1" : "0" }};
+    shader.setShaderPaths((impostors ? impostorVertexPath : vertexPath).c_str(), fragmentPath.c_str());
+    shader.setPlaceholders(placeholders);
     shader.compileAndLink();
+    pointShader.setShaderPaths(pointVertexPath.c_str(), pointFragmentPath.c_str());
+    pointShader.compileAndLink();
 }
-void SphereManager::useShader()
+
+/**
+ * @brief SphereManager::useShader
+ * Bind the program the slot's render state is drawn with
+ */
+void SphereManager::useShader(unsigned slot)
 {
-    shader.use();
+    if(renderStates[slot % RENDER_STATE_COUNT].mode == RenderMode::Points) {
+        pointShader.use();
+    }
+    else {
+        shader.use();
+    }
 }
 
 /**
- * @brief SphereManager::gravitateSerialAbsorbCollisions
+ * @brief SphereManager::setPointSprites
+ * Switch between point sprites and the configured render mode; takes
+ *   effect from the next updateRenderState
  */
-void SphereManager::gravitateSerialAbsorbCollisions(float duration)
-{
-    glm::vec3 diff;
-    float len;
-    std::fill(accelerations.begin(), accelerations.end(), glm::vec3(0.0));
-    for(GLuint i = 0; i < locations.size() - 1; i++) {
-        for(GLuint j = i + 1; j < locations.size(); j++) {
-            diff = locations[j] - locations[i];
-            len = glm::length(diff);
-            if(len <= radii[i] + radii[j]) {
-                // One sphere absorbs another. If it's a lightsource,
-                //   it will absorb the other object by default.
-                float newMass = masses[i] + masses[j];
-                float newRadius = pow(3.0f * newMass / (4 * M_PI * density), 1.0 / 3.0);
-                //glm::vec3 newColor = colorScaler * (1 / masses[i] * colors[j] + 1 / masses[j] * colors[i]);
-                // Conserve momentum
-                glm::vec3 newVel = (velocities[i] * masses[i] + velocities[j] * masses[j]) / newMass;
-                int eraseIndex, keepIndex;
-                if(isLightSource[i] || radii[i] > radii[j]) {
-                    // Delete j, because light source absorbs all
-                    keepIndex = i;
-                    eraseIndex = j;
-                }
-                else {
-                    keepIndex = j;
-                    eraseIndex = i;
-                }
-                masses[keepIndex] = newMass;
-                radii[keepIndex] = newRadius;
-                velocities[keepIndex] = newVel;
-                //colors[keepIndex] = newColor;
-
-                models.erase(models.begin() + eraseIndex);
-                radii.erase(radii.begin() + eraseIndex);
-                normals.erase(normals.begin() + eraseIndex);
-                locations.erase(locations.begin() + eraseIndex);
-                velocities.erase(velocities.begin() + eraseIndex);
-                accelerations.erase(accelerations.begin() + eraseIndex);
-                masses.erase(masses.begin() + eraseIndex);
-                isLightSource.erase(isLightSource.begin() + eraseIndex);
-                colors.erase(colors.begin() + eraseIndex);
-                // Remove light source indices or decrement them as necessary
-                int lightSourceDeleteIndex = -1;
-                for(GLuint k = 0; k < lightSourceIndices.size(); k++) {
-                    if(lightSourceIndices[k] == eraseIndex) {
-                        //lightSourceIndices.erase(lightSourceIndices.begin() + k);
-                        lightSourceDeleteIndex = k;
-                    }
-                    else if(lightSourceIndices[k] > eraseIndex) {
-                        lightSourceIndices[k]--;
-                    }
-                }
-                // Delete the light source index if it's being erased
-                if(lightSourceDeleteIndex != -1) {
-                    lightSourceIndices.erase(lightSourceIndices.begin() + lightSourceDeleteIndex);
-                    lightSourceDeleteIndex = -1;
-                }
-            }
-            else {
-                glm::vec3 norm = diff / len;
-                float k = G / (len * len); // G / r^2
-                accelerations[i] += masses[j] * k * norm;
-                accelerations[j] += -masses[i] * k * norm;
-            }
+void SphereManager::setPointSprites(bool enabled)
+{
+    pointSprites = enabled;
+}
+
+bool SphereManager::getPointSprites() const
+{
+    return pointSprites;
+}
+
+/**
+ * @brief SphereManager::mergeContacts
+ * Resolve a whole step's worth of contacts at once; see SphereMerger
+ */
+void SphereManager::mergeContacts(const std::vector<ContactPair>& contacts)
+{
+    merger.merge(particles, colors, isLightSource, lightSourceIndices, contacts, density);
+    attributeVersion++;
+}
+
+/**
+ * @brief SphereManager::absorbCollisions
+ * Merge every overlapping pair the spatial hash broad-phase finds. Spheres
+ *   that grow into new neighbours are picked up on the next step.
+ */
+void SphereManager::absorbCollisions()
+{
+    const std::vector<ContactPair>& contacts = spatialHash.findContacts(particles.view(), threadCount);
+    if(!contacts.empty()) {
+        mergeContacts(contacts);
+        integrator.invalidate();
+        hermite.invalidate();
+    }
+}
+
+/**
+ * @brief SphereManager::accelerateDirect
+ * Exact forces from the vectorized kernel, on the calling thread alone or
+ *   split into blocks of rows shared out over the scheduler's workers.
+ *   Overlapping pairs are left out of the sum and merged after the step.
+ */
+void SphereManager::accelerateDirect(GLuint nThreads)
+{
+    directKernel.computeAccelerations(particles.view(), G, particles.accelerations(), nThreads);
+}
+
+/**
+ * @brief SphereManager::accelerateBarnesHut
+ * O(N log N) approximate forces from the octree
+ */
+void SphereManager::accelerateBarnesHut()
+{
+    barnesHut.computeAccelerations(particles.view(), G, particles.accelerations(), threadCount);
+}
+
+/**
+ * @brief SphereManager::accelerateFastMultipole
+ * O(N) forces from the multipole expansion. Every FMM_ERROR_INTERVAL force
+ *   evaluations a sample of bodies is checked against direct summation and
+ *   the relative force error is printed.
+ */
+void SphereManager::accelerateFastMultipole()
+{
+    fastMultipole.computeAccelerations(particles.view(), G, particles.accelerations(), threadCount);
+    if(stepCount++ % FMM_ERROR_INTERVAL == 0) {
+        float error = FastMultipole::measureError(particles.view(), G, particles.accelerations(), FMM_ERROR_SAMPLES);
+        std::cout << "FMM (p = " << fastMultipole.getOrder() << ") relative force error: " << error << std::endl;
+    }
+}
+
+/**
+ * @brief SphereManager::accelerateParticleMesh
+ * Grid forces for large, smooth distributions, optionally with the P3M
+ *   short-range pass for close pairs.
+ */
+void SphereManager::accelerateParticleMesh()
+{
+    particleMesh.computeAccelerations(particles.view(), G, particles.accelerations(), threadCount);
+}
+
+/**
+ * @brief SphereManager::computeAccelerations
+ * One force evaluation with the solver chosen in the settings
+ */
+void SphereManager::computeAccelerations()
+{
+    switch(engine) {
+        case GravityEngine::BarnesHut:
+            accelerateBarnesHut();
+            break;
+        case GravityEngine::FastMultipole:
+            accelerateFastMultipole();
+            break;
+        case GravityEngine::ParticleMesh:
+            accelerateParticleMesh();
+            break;
+        default:
+            accelerateDirect(threadCount);
+    }
+}
+
+/**
+ * @brief SphereManager::step
+ * One fixed physics step, then the merges for whatever ended up
+ *   overlapping. The Hermite scheme needs the jerk as well as the
+ *   acceleration, so it always sums directly, ignoring the chosen engine;
+ *   its block steps subdivide dt per body.
+ */
+void SphereManager::step(float dt)
+{
+    if(integrator.getScheme() == IntegrationScheme::Hermite) {
+        hermite.step(particles, G, dt, threadCount);
+    }
+    else {
+        integrator.step(particles, dt, [this]() { computeAccelerations(); });
+    }
+    absorbCollisions();
+    if(pinThreads && ++numaReportStep % NUMA_REPORT_INTERVAL == 0) {
+        numaReport.print();
+    }
+}
+
+/**
+ * @brief SphereManager::reportParticlePlacement
+ * Print how many pages of the particle arrays each NUMA node holds, to
+ *   check that first touch spread them over the nodes of the workers.
+ */
+void SphereManager::reportParticlePlacement()
+{
+    const NumaTopology& topology = NumaTopology::system();
+    std::vector<size_t> total(topology.getNodeCount(), 0);
+    const AlignedFloats* fields[] = { &particles.x, &particles.y, &particles.z, &particles.vx, &particles.vy,
+                                      &particles.vz, &particles.ax, &particles.ay, &particles.az,
+                                      &particles.mass, &particles.radius };
+    for(const AlignedFloats* field : fields) {
+        std::vector<size_t> pages = topology.pagesPerNode(field->data(), field->size() * sizeof(float));
+        for(size_t node = 0; node < total.size(); node++) {
+            total[node] += pages[node];
         }
     }
-    for(GLuint i = 0; i < locations.size(); i++) {
-        velocities[i] += duration * accelerations[i];
-        locations[i] += duration * velocities[i];
-        models[i] = glm::translate(glm::mat4(1.0), locations[i]);
-        models[i] = glm::scale(models[i], glm::vec3(radii[i]));
+    for(size_t node = 0; node < total.size(); node++) {
+        std::cout << "NUMA node " << node << ": " << total[node] << " particle pages" << std::endl;
+    }
+}
+
+/**
+ * @brief SphereManager::publishSnapshot
+ * Copy the current state into the triple buffer's back slot and hand it to
+ *   the renderer. Only ever called from whichever thread runs the physics.
+ */
+void SphereManager::publishSnapshot()
+{
+    PhysicsSnapshot& snapshot = snapshots.writeBuffer();
+    const size_t N = particles.size();
+    snapshot.x = particles.x;
+    snapshot.y = particles.y;
+    snapshot.z = particles.z;
+    // After a merge the indices no longer line up, so there is nothing to
+    //   interpolate from
+    const bool sameSpheres = publishedCount == N;
+    snapshot.previousX = sameSpheres ? publishedX : particles.x;
+    snapshot.previousY = sameSpheres ? publishedY : particles.y;
+    snapshot.previousZ = sameSpheres ? publishedZ : particles.z;
+    // The rest only changes on a merge, and this slot may already have it
+    if(snapshot.attributeVersion != attributeVersion) {
+        snapshot.mass = particles.mass;
+        snapshot.radius = particles.radius;
+        snapshot.colors = colors;
+        snapshot.isLightSource = isLightSource;
+        snapshot.lightSourceIndices = lightSourceIndices;
+        snapshot.attributeVersion = attributeVersion;
+    }
+    snapshot.version = ++publishVersion;
+    snapshot.count = N;
+    snapshot.time = wallClock();
+    snapshot.previousTime = sameSpheres ? publishedTime : snapshot.time;
+    snapshots.publish();
+
+    publishedX = particles.x;
+    publishedY = particles.y;
+    publishedZ = particles.z;
+    publishedCount = N;
+    publishedTime = snapshot.time;
+}
+
+/**
+ * @brief SphereManager::physicsLoop
+ * Body of the physics thread: fixed steps paced to wall-clock time, each
+ *   one published as a snapshot. Steps that fall behind the schedule are
+ *   run back to back to catch up, as long as the backlog stays under
+ *   maxSubsteps steps; past that the schedule is reset, so the simulation
+ *   slows down instead of spiralling. While paused, nothing is published
+ *   and the renderer keeps showing the last state.
+ */
+void SphereManager::physicsLoop()
+{
+    typedef std::chrono::steady_clock Clock;
+    const Clock::duration stepDuration = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(timeStep));
+    Clock::time_point next = Clock::now();
+    if(pinThreads) {
+        // The scheduler's workers take the other cores
+        pinCurrentThread(0);
+    }
+    while(physicsRunning.load()) {
+        if(physicsPaused.load()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            next = Clock::now();
+            // Don't interpolate across the pause
+            publishedTime = wallClock();
+            continue;
+        }
+        step(timeStep);
+        publishSnapshot();
+        next += stepDuration;
+        Clock::time_point now = Clock::now();
+        if(now < next) {
+            std::this_thread::sleep_until(next);
+        }
+        else if(now - next >= maxSubsteps * stepDuration) {
+            next = now;
+        }
+    }
+}
+
+/**
+ * @brief SphereManager::startPhysics
+ * Move the simulation onto its own thread. Call after initializeSpheres;
+ *   from then on only the physics thread touches the particles, and the
+ *   render thread reads snapshots through updateRenderState. Starts paused.
+ */
+void SphereManager::startPhysics()
+{
+    if(physicsRunning.load()) {
+        return;
+    }
+    physicsPaused = true;
+    physicsRunning = true;
+    physicsThread = std::thread(&SphereManager::physicsLoop, this);
+}
+
+void SphereManager::stopPhysics()
+{
+    physicsRunning = false;
+    if(physicsThread.joinable()) {
+        physicsThread.join();
+    }
+}
+
+void SphereManager::setPaused(bool paused)
+{
+    physicsPaused = paused;
+}
+
+/**
+ * @brief SphereManager::updateRenderState
+ * Pick up the newest snapshot, if any, and rebuild the light sources and
+ *   instances from it through the InstanceWriter, into the mapped instance
+ *   region. Locations are interpolated between the snapshot's previous and
+ *   current states by how far the wall clock has moved past the current
+ *   one, which puts the rendered state one physics step behind but moving
+ *   smoothly whatever the frame rate. Only the given slot is written, so
+ *   another may be drawn from meanwhile. The sphere attributes are only
+ *   rebuilt after a merge.
+ *
+ *   The view and projection are kept with the slot for the draw. Level of
+ *   detail selection also needs how many pixels a unit of radius covers at
+ *   unit depth, which the viewport height gives.
+ */
+void SphereManager::updateRenderState(unsigned slot, const glm::mat4& view, const glm::mat4& projection, float viewportHeight)
+{
+    RenderState& state = renderStates[slot % RENDER_STATE_COUNT];
+    const RenderState& last = renderStates[lastRenderSlot];
+    lastRenderSlot = slot % RENDER_STATE_COUNT;
+    snapshots.acquire();
+    const PhysicsSnapshot& snapshot = snapshots.readBuffer();
+    const double span = snapshot.time - snapshot.previousTime;
+    float alpha = 1.0f;
+    if(span > 0.0) {
+        alpha = (float) std::min(std::max((wallClock() - snapshot.time) / span, 0.0), 1.0);
+    }
+    const size_t N = std::min(snapshot.count, instanceCapacity);
+
+    if(state.attributeVersion != snapshot.attributeVersion) {
+        state.attributes.resize(N);
+        for(size_t i = 0; i < N; i++) {
+            const glm::vec4 color(snapshot.colors[i], snapshot.isLightSource[i] ? 1.0f : 0.0f);
+            state.attributes[i] = SphereAttributes{ glm::packUnorm4x8(color), snapshot.radius[i] };
+        }
+        state.attributeVersion = snapshot.attributeVersion;
+    }
+
+    state.mode = pointSprites ? RenderMode::Points : renderMode;
+    state.view = view;
+    state.projection = projection;
+    state.pixelScale = projection[1][1] * viewportHeight / 2.0f;
+    instanceWriter.write(state, last, snapshot, N, alpha, gpuCuller.isSupported(), instances[slot % RENDER_STATE_COUNT]);
+    if(!state.reuseInstances && state.compact != compactInstances) {
+        compactInstances = state.compact;
+        std::cout << "Instance format: " << (compactInstances ? "compact (12 bytes)" : "full (16 bytes)") << std::endl;
     }
 }
 
@@ -287,17 +789,31 @@ std::vector<GLuint>& SphereManager::getIndices()
     return sphere.getIndices();
 }
 
-GLuint SphereManager::getSphereCount()
+const glm::mat4& SphereManager::getRenderView(unsigned slot) const
 {
-    return models.size();
+    return renderStates[slot % RENDER_STATE_COUNT].view;
 }
 
-std::vector<glm::vec3>& SphereManager::getLocations()
+const glm::mat4& SphereManager::getRenderProjection(unsigned slot) const
 {
-    return locations;
+    return renderStates[slot % RENDER_STATE_COUNT].projection;
 }
 
-std::vector<float>& SphereManager::getMasses()
+/**
+ * @brief SphereManager::getParticles
+ * Borrowed view of the snapshot the renderer holds; invalidated by the
+ *   next updateRenderState.
+ */
+ParticleView SphereManager::getParticles() const
 {
-    return masses;
+    const PhysicsSnapshot& snapshot = snapshots.readBuffer();
+    ParticleView view;
+    view.x = snapshot.x.data();
+    view.y = snapshot.y.data();
+    view.z = snapshot.z.data();
+    view.mass = snapshot.mass.data();
+    view.radius = snapshot.radius.data();
+    view.count = snapshot.count;
+    view.paddedCount = snapshot.x.size();
+    return view;
 }
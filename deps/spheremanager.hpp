@@ -1,15 +1,44 @@
 #ifndef SPHERE_MANAGER
 #define SPHERE_MANAGER
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <barneshut.hpp>
+#include <directkernel.hpp>
 #include <entity.hpp>
+#include <fastmultipole.hpp>
+#include <frustum.hpp>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+#include <gpuculler.hpp>
+#include <hermite.hpp>
+#include <instancebuffer.hpp>
+#include <instancewriter.hpp>
+#include <integrator.hpp>
+#include <limits>
+#include <numatopology.hpp>
 #include <parametermanager.h>
+#include <particlemesh.hpp>
+#include <particlestore.hpp>
 #include <qt5/QtCore/QObject>
 #include <random>
 #include <shader.h>
+#include <spatialhash.hpp>
+#include <spheremerger.hpp>
+#include <taskscheduler.hpp>
+#include <thread>
+#include <triplebuffer.hpp>
 #include <type_traits>
+#include <utility>
+
+// Copies of the render state, so one can be filled while another is drawn;
+//   each has its own instance region
+const unsigned RENDER_STATE_COUNT = INSTANCE_BUFFER_SLOTS;
 
 /**
  * To enable instancing, this contains all the relevant buffers, the 
@@ -19,45 +48,122 @@
 class SphereManager
 {
     GLuint VAO, VBO, EBO;
+    GLuint lightBuffer, lightTexture;
+    GLuint attributeBuffer, attributeTexture;
     Sphere sphere;
     Shader shader;
+    Shader pointShader;
+    // The mesh and impostor vertex shaders share the fragment shader, which
+    //   is compiled for whichever the render mode picks. Point sprites have
+    //   a program of their own, so they can be switched to at any time.
+    std::string vertexPath, impostorVertexPath, fragmentPath;
+    std::string pointVertexPath, pointFragmentPath;
+    std::string cullComputePath;
+    RenderMode renderMode;
+    std::atomic<bool> pointSprites;
+    // Where the context allows, meshes are culled and sorted by level of
+    //   detail on the GPU instead of in updateRenderState
+    GpuCuller gpuCuller;
 
     float G; // gravitational constant
     float density;
+    GLuint threadCount;
+    bool pinThreads;
+    NumaReport numaReport;
+    GLuint numaReportStep;
+    GravityEngine engine;
+    DirectKernel directKernel;
+    BarnesHut barnesHut;
+    FastMultipole fastMultipole;
+    ParticleMesh particleMesh;
+    SpatialHash spatialHash;
+    Integrator integrator;
+    HermiteIntegrator hermite;
+    float timeStep;
+    GLuint maxSubsteps;
+    GLuint stepCount;
     glm::vec3 ambientColor;
 
-    std::vector<glm::mat4> models;
-    std::vector<glm::mat3> normals;
+    // Physics thread state: aligned, padded structure-of-arrays plus the
+    //   per-sphere attributes that merges compact along with it
+    ParticleStore particles;
     std::vector<glm::vec3> colors;
-    std::vector<glm::vec3> locations;
-    std::vector<glm::vec3> velocities;
-    std::vector<glm::vec3> accelerations;
-    std::vector<float> masses;
-    std::vector<float> radii;
     std::vector<GLint> lightSourceIndices;
     std::vector<GLint> isLightSource;
+    uint64_t attributeVersion;
+    uint64_t publishVersion;
+
+    // Hand-off between the threads, and the physics side's record of the
+    //   last published locations
+    TripleBuffer<PhysicsSnapshot> snapshots;
+    AlignedFloats publishedX, publishedY, publishedZ;
+    size_t publishedCount;
+    double publishedTime;
+    std::thread physicsThread;
+    std::atomic<bool> physicsRunning;
+    std::atomic<bool> physicsPaused;
+
+    // Render side, rebuilt from the latest snapshot each frame
+    RenderState renderStates[RENDER_STATE_COUNT];
+    // Ring of instances, the region the next frame writes them to, and the
+    //   format the last frame chose
+    InstanceBuffer instanceBuffer;
+    void* instances[RENDER_STATE_COUNT];
+    bool compactInstances;
+    // What the last frame wrote and the GL side last uploaded
+    InstanceWriter instanceWriter;
+    unsigned lastRenderSlot;
+    uint64_t uploadedLightVersion;
+    uint64_t uploadedAttributeVersion;
+    GLintptr instanceOffset;
+    size_t instanceCapacity;
+
+    SphereMerger merger;
 
-    void initializeShader(GLuint N);
+    void initializeShader();
     void deleteBuffers();
+    void pointInstanceAttributes(const RenderState& state, GLintptr first);
+    void mergeContacts(const std::vector<ContactPair>& contacts);
+    void absorbCollisions();
+    void accelerateDirect(GLuint nThreads);
+    void accelerateBarnesHut();
+    void accelerateFastMultipole();
+    void accelerateParticleMesh();
+    void computeAccelerations();
+    void step(float dt);
+    void reportParticlePlacement();
+    void publishSnapshot();
+    void physicsLoop();
 
 public:
-    SphereManager(const char* vertexPath, const char* fragmentPath);
+    SphereManager(const char* vertexPath, const char* impostorVertexPath, const char* fragmentPath,
+                  const char* pointVertexPath, const char* pointFragmentPath, const char* cullComputePath);
     ~SphereManager();
     void generateBuffers();
     void bindVertexArray();
     void bindEBO();
     void bindVBO();
     void enableAttributes();
-    void setShaderUniforms(glm::mat4& view, glm::mat4& projection);
-    void useShader();
+    void setShaderUniforms(glm::mat4& view, glm::mat4& projection, unsigned slot = 0);
+    void bindInstances(unsigned slot = 0);
+    void cullInstances(const glm::mat4& view, const glm::mat4& projection, unsigned slot = 0);
+    void drawInstances(unsigned slot = 0);
+    void fenceInstances(unsigned slot = 0);
+    double takeAverageFenceStall();
+    void useShader(unsigned slot = 0);
+    void setPointSprites(bool enabled);
+    bool getPointSprites() const;
 
     void initializeSpheres(std::default_random_engine& randEngine, ParameterManager& paramManager);
-    void gravitateSerialAbsorbCollisions(float duration);
-    void gravitateParallel();
-    std::vector<glm::vec3>& getLocations();
-    std::vector<float>& getMasses();
+    void startPhysics();
+    void stopPhysics();
+    void setPaused(bool paused);
+    void updateRenderState(unsigned slot = 0, const glm::mat4& view = glm::mat4(1.0f),
+                           const glm::mat4& projection = glm::mat4(1.0f), float viewportHeight = 2.0f);
+    const glm::mat4& getRenderView(unsigned slot = 0) const;
+    const glm::mat4& getRenderProjection(unsigned slot = 0) const;
+    ParticleView getParticles() const;
     std::vector<GLuint>& getIndices();
-    GLuint getSphereCount();
     
 };
 
@@ -0,0 +1,103 @@
+#include <cmath>
+#include <spheremerger.hpp>
+
+/**
+ * @brief SphereMerger::absorbs
+ * Whether sphere i survives a merge with j. A light source absorbs anything,
+ *   otherwise the larger sphere wins, and ties go to the lower index.
+ */
+bool SphereMerger::absorbs(const ParticleStore& particles, const std::vector<int>& isLightSource, unsigned i, unsigned j)
+{
+    if(isLightSource[i] != isLightSource[j]) {
+        return isLightSource[i];
+    }
+    if(particles.radius[i] != particles.radius[j]) {
+        return particles.radius[i] > particles.radius[j];
+    }
+    return i < j;
+}
+
+/**
+ * @brief SphereMerger::findRoot
+ * Union-find lookup with path halving
+ */
+unsigned SphereMerger::findRoot(unsigned i)
+{
+    while(parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+/**
+ * @brief SphereMerger::merge
+ * Resolve a whole step's worth of contacts at once. Merged spheres take the
+ *   radius of a ball of the given density holding the group's mass; colors,
+ *   isLightSource and lightSourceIndices are compacted alongside particles.
+ */
+void SphereMerger::merge(ParticleStore& particles, std::vector<glm::vec3>& colors, std::vector<int>& isLightSource,
+                         std::vector<int>& lightSourceIndices, const std::vector<ContactPair>& contacts, float density)
+{
+    const unsigned N = particles.size();
+    parent.resize(N);
+    for(unsigned i = 0; i < N; i++) {
+        parent[i] = i;
+    }
+    for(const ContactPair& contact : contacts) {
+        unsigned a = findRoot(contact.first);
+        unsigned b = findRoot(contact.second);
+        if(a == b) {
+            continue;
+        }
+        if(absorbs(particles, isLightSource, a, b)) {
+            parent[b] = a;
+        }
+        else {
+            parent[a] = b;
+        }
+    }
+
+    mass.assign(particles.mass.begin(), particles.mass.begin() + N);
+    momentum.resize(N);
+    removed.assign(N, 0);
+    for(unsigned i = 0; i < N; i++) {
+        momentum[i] = particles.mass[i] * particles.velocity(i);
+    }
+    for(unsigned i = 0; i < N; i++) {
+        unsigned root = findRoot(i);
+        if(root != i) {
+            mass[root] += particles.mass[i];
+            momentum[root] += momentum[i];
+            removed[i] = 1;
+        }
+    }
+    for(unsigned i = 0; i < N; i++) {
+        if(removed[i] || mass[i] == particles.mass[i]) {
+            continue;
+        }
+        particles.mass[i] = mass[i];
+        particles.radius[i] = pow(3.0f * mass[i] / (4 * M_PI * density), 1.0 / 3.0);
+        particles.setVelocity(i, momentum[i] / mass[i]);
+    }
+
+    // One stable pass over every per-sphere array
+    particles.compact(removed);
+    unsigned kept = 0;
+    for(unsigned i = 0; i < N; i++) {
+        if(removed[i]) {
+            continue;
+        }
+        colors[kept] = colors[i];
+        isLightSource[kept] = isLightSource[i];
+        kept++;
+    }
+    colors.resize(kept);
+    isLightSource.resize(kept);
+    lightSourceIndices.clear();
+    for(unsigned i = 0; i < kept; i++) {
+        if(isLightSource[i]) {
+            lightSourceIndices.push_back(i);
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef SPHERE_MERGER_HPP
+#define SPHERE_MERGER_HPP
+
+#include <glm/glm.hpp>
+#include <particlestore.hpp>
+#include <spatialhash.hpp>
+#include <vector>
+
+/**
+ * Batched resolution of sphere contacts. Touching spheres are joined into
+ *   groups with a union-find whose root is always the sphere that absorbs
+ *   the rest, so chains (A eats B eats C) collapse in one pass. Each group
+ *   keeps its root's location and conserves mass and momentum, and then
+ *   every per-sphere array is compacted once instead of erased per merge.
+*/
+class SphereMerger
+{
+    std::vector<unsigned> parent;
+    std::vector<float> mass;
+    std::vector<glm::vec3> momentum;
+    std::vector<char> removed;
+
+    unsigned findRoot(unsigned i);
+
+public:
+    static bool absorbs(const ParticleStore& particles, const std::vector<int>& isLightSource, unsigned i, unsigned j);
+
+    void merge(ParticleStore& particles, std::vector<glm::vec3>& colors, std::vector<int>& isLightSource,
+               std::vector<int>& lightSourceIndices, const std::vector<ContactPair>& contacts, float density);
+};
+
+#endif
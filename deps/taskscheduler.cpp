@@ -0,0 +1,316 @@
+#include <taskscheduler.hpp>
+#include <algorithm>
+#include <numatopology.hpp>
+
+// The scheduler and queue the current thread belongs to, if it is a worker
+static thread_local const TaskScheduler* currentScheduler = nullptr;
+static thread_local unsigned currentQueue = 0;
+
+TaskScheduler::TaskScheduler(unsigned threadCount)
+    : stopping(false), queued(0), pinned(false), staticPartition(false)
+{
+    start(threadCount);
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    stop();
+}
+
+TaskScheduler& TaskScheduler::shared()
+{
+    static TaskScheduler scheduler;
+    return scheduler;
+}
+
+void TaskScheduler::start(unsigned threadCount)
+{
+    if(threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    stopping = false;
+    queues.clear();
+    for(unsigned i = 0; i < threadCount; i++) {
+        queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for(unsigned i = 0; i + 1 < threadCount; i++) {
+        workers.push_back(std::thread(&TaskScheduler::workerLoop, this, i));
+    }
+}
+
+void TaskScheduler::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void TaskScheduler::setThreadCount(unsigned threadCount)
+{
+    if(threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    if(threadCount == getThreadCount()) {
+        return;
+    }
+    stop();
+    start(threadCount);
+}
+
+unsigned TaskScheduler::getThreadCount() const
+{
+    return workers.size() + 1;
+}
+
+void TaskScheduler::setPinned(bool pinned)
+{
+    if(pinned == TaskScheduler::pinned) {
+        return;
+    }
+    const unsigned threadCount = getThreadCount();
+    stop();
+    TaskScheduler::pinned = pinned;
+    start(threadCount);
+}
+
+bool TaskScheduler::getPinned() const
+{
+    return pinned;
+}
+
+void TaskScheduler::setStaticPartition(bool staticPartition)
+{
+    TaskScheduler::staticPartition = staticPartition;
+}
+
+bool TaskScheduler::getStaticPartition() const
+{
+    return staticPartition;
+}
+
+/**
+ * Workers push to their own deque; everyone else shares the last one
+ */
+unsigned TaskScheduler::ownQueue() const
+{
+    return currentScheduler == this ? currentQueue : queues.size() - 1;
+}
+
+void TaskScheduler::spawn(TaskGroup& group, Task task)
+{
+    push(ownQueue(), group, std::move(task), false);
+}
+
+void TaskScheduler::push(unsigned queueIndex, TaskGroup& group, Task task, bool bind)
+{
+    group.pending++;
+    Queue& queue = *queues[queueIndex];
+    {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        (bind ? queue.bound : queue.jobs).push_back(Job{std::move(task), &group});
+    }
+    if(bind) {
+        queue.boundQueued++;
+    }
+    else {
+        queued++;
+    }
+    // Taking the lock orders this against a worker about to go to sleep.
+    //   Any worker can run a plain job, but only the owner a bound one, and
+    //   the workers share one condition variable, so wake them all for it.
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+    }
+    if(bind) {
+        wake.notify_all();
+    }
+    else {
+        wake.notify_one();
+    }
+}
+
+/**
+ * Run one queued task: a block bound to us, the newest from our own deque,
+ *   or else the oldest from someone else's.
+ */
+bool TaskScheduler::tryRun()
+{
+    const unsigned own = ownQueue();
+    if(queued.load() == 0 && queues[own]->boundQueued.load() == 0) {
+        return false;
+    }
+    const unsigned count = queues.size();
+    Job job;
+    bool found = false;
+    bool bound = false;
+    for(unsigned k = 0; k < count && !found; k++) {
+        Queue& queue = *queues[(own + k) % count];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if(k == 0 && !queue.bound.empty()) {
+            job = std::move(queue.bound.front());
+            queue.bound.pop_front();
+            found = bound = true;
+            continue;
+        }
+        if(queue.jobs.empty()) {
+            continue;
+        }
+        if(k == 0 && currentScheduler == this) {
+            job = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+        }
+        else {
+            job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+        }
+        found = true;
+    }
+    if(!found) {
+        return false;
+    }
+    if(bound) {
+        queues[own]->boundQueued--;
+    }
+    else {
+        queued--;
+    }
+    job.task();
+    job.group->pending--;
+    return true;
+}
+
+void TaskScheduler::workerLoop(unsigned index)
+{
+    currentScheduler = this;
+    currentQueue = index;
+    if(pinned) {
+        // The outside thread that submits work keeps CPU 0
+        pinCurrentThread((index + 1) % NumaTopology::system().getCpuCount());
+    }
+    while(!stopping.load()) {
+        if(tryRun()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepLock);
+        // Sleep until there is work this worker can run; a block bound to
+        //   another worker doesn't count, or it would spin on it
+        Queue& own = *queues[index];
+        wake.wait(lock, [this, &own]() { return stopping.load() || queued.load() > 0 || own.boundQueued.load() > 0; });
+    }
+}
+
+void TaskScheduler::wait(TaskGroup& group)
+{
+    while(group.pending.load() > 0) {
+        if(!tryRun()) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+/**
+ * body(first, last) over [begin, end) in chunks of grain items. The calling
+ *   thread takes part, and with a single thread or a single chunk the body
+ *   simply runs inline.
+ */
+void TaskScheduler::parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body)
+{
+    if(end <= begin) {
+        return;
+    }
+    grain = std::max(grain, (size_t) 1);
+    if(workers.empty() || end - begin <= grain) {
+        body(begin, end);
+        return;
+    }
+    if(staticPartition && currentScheduler != this) {
+        parallelForStatic(begin, end, body);
+        return;
+    }
+    TaskGroup group;
+    for(size_t first = begin + grain; first < end; first += grain) {
+        const size_t last = std::min(first + grain, end);
+        spawn(group, [&body, first, last]() { body(first, last); });
+    }
+    body(begin, begin + grain);
+    wait(group);
+}
+
+/**
+ * Block k of getThreadCount() equal blocks always runs on worker k, and
+ *   the last block on the calling thread, so a particle keeps the worker
+ *   (and with pinning, the node) that first touched it.
+ */
+void TaskScheduler::parallelForStatic(size_t begin, size_t end, const std::function<void(size_t, size_t)>& body)
+{
+    const size_t blocks = getThreadCount();
+    const size_t chunk = (end - begin + blocks - 1) / blocks;
+    TaskGroup group;
+    for(size_t k = 0; k + 1 < blocks; k++) {
+        const size_t first = std::min(begin + k * chunk, end);
+        const size_t last = std::min(first + chunk, end);
+        if(first < last) {
+            push(k, group, [&body, first, last]() { body(first, last); }, true);
+        }
+    }
+    const size_t first = std::min(begin + (blocks - 1) * chunk, end);
+    if(first < end) {
+        body(first, end);
+    }
+    wait(group);
+}
+
+TaskGraph::TaskId TaskGraph::add(TaskScheduler::Task task, const std::vector<TaskId>& after)
+{
+    const TaskId id = nodes.size();
+    std::unique_ptr<Node> node(new Node());
+    node->task = std::move(task);
+    node->dependencies = after.size();
+    node->remaining = 0;
+    nodes.push_back(std::move(node));
+    for(TaskId predecessor : after) {
+        nodes[predecessor]->successors.push_back(id);
+    }
+    return id;
+}
+
+void TaskGraph::launch(TaskScheduler& scheduler, TaskGroup& group, TaskId id)
+{
+    scheduler.spawn(group, [this, &scheduler, &group, id]() {
+        nodes[id]->task();
+        for(TaskId successor : nodes[id]->successors) {
+            if(--nodes[successor]->remaining == 0) {
+                launch(scheduler, group, successor);
+            }
+        }
+    });
+}
+
+/**
+ * Run every task once, respecting the dependencies, and return when all
+ *   have finished. The graph can be run again.
+ */
+void TaskGraph::run(TaskScheduler& scheduler)
+{
+    for(auto& node : nodes) {
+        node->remaining = node->dependencies;
+    }
+    TaskGroup group;
+    for(TaskId id = 0; id < nodes.size(); id++) {
+        if(nodes[id]->dependencies == 0) {
+            launch(scheduler, group, id);
+        }
+    }
+    scheduler.wait(group);
+}
+
+void TaskGraph::clear()
+{
+    nodes.clear();
+}
@@ -0,0 +1,166 @@
+#ifndef TASK_SCHEDULER_HPP
+#define TASK_SCHEDULER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Outstanding tasks spawned into a scheduler; wait() returns once they have
+ *   all finished, including anything they spawned into the same group.
+*/
+class TaskGroup
+{
+    friend class TaskScheduler;
+    std::atomic<size_t> pending;
+
+public:
+    TaskGroup() : pending(0) {}
+};
+
+/**
+ * Work-stealing thread pool. Every worker has its own deque: it pushes and
+ *   pops its own tasks at the back, so nested work stays hot in its cache,
+ *   and idle workers steal the oldest (largest) tasks from the front of the
+ *   others. Threads outside the pool submit through a shared queue. A thread
+ *   waiting on a group runs queued tasks instead of blocking, so tasks may
+ *   themselves spawn and wait without deadlocking the pool.
+*/
+class TaskScheduler
+{
+public:
+    typedef std::function<void()> Task;
+
+private:
+    struct Job {
+        Task task;
+        TaskGroup* group;
+    };
+    struct Queue {
+        std::mutex lock;
+        std::deque<Job> jobs;
+        std::deque<Job> bound;  // static blocks only the owner may run
+        std::atomic<size_t> boundQueued{0};
+    };
+
+    // One queue per worker, then the queue for outside threads
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<bool> stopping;
+    std::atomic<size_t> queued;  // jobs any thread may run, not bound ones
+    bool pinned;
+    bool staticPartition;
+    std::mutex sleepLock;
+    std::condition_variable wake;
+
+    void start(unsigned threadCount);
+    void stop();
+    void workerLoop(unsigned index);
+    unsigned ownQueue() const;
+    void push(unsigned queue, TaskGroup& group, Task task, bool bind);
+    void parallelForStatic(size_t begin, size_t end, const std::function<void(size_t, size_t)>& body);
+
+public:
+    // threadCount includes the thread that calls wait(); 0 picks one per core
+    explicit TaskScheduler(unsigned threadCount = 0);
+    ~TaskScheduler();
+
+    // The pool used by the simulation, culling and diagnostics
+    static TaskScheduler& shared();
+
+    // Restarts the workers, so only call it while no tasks are running
+    void setThreadCount(unsigned threadCount);
+    unsigned getThreadCount() const;
+
+    // Workers bound to one core each; restarts them, like setThreadCount
+    void setPinned(bool pinned);
+    bool getPinned() const;
+    // Top-level loops split into one fixed block per thread, so each
+    //   worker sees the same index range every time instead of stealing
+    void setStaticPartition(bool staticPartition);
+    bool getStaticPartition() const;
+
+    void spawn(TaskGroup& group, Task task);
+    void wait(TaskGroup& group);
+    // Run one queued task if there is one, for threads waiting on something
+    //   other than a task group
+    bool tryRun();
+
+    void parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+    /**
+     * map(begin, end) reduces one chunk to a T; the chunk results are then
+     *   combined in order, so the result does not depend on which thread
+     *   ran which chunk.
+     */
+    template <typename T, typename Map, typename Combine>
+    T parallelReduce(size_t begin, size_t end, size_t grain, T identity, Map map, Combine combine)
+    {
+        if(end <= begin) {
+            return identity;
+        }
+        grain = grain > 0 ? grain : 1;
+        const size_t chunks = (end - begin + grain - 1) / grain;
+        std::vector<T> partial(chunks, identity);
+        parallelFor(0, chunks, 1, [&](size_t first, size_t last) {
+            for(size_t c = first; c < last; c++) {
+                const size_t lower = begin + c * grain;
+                partial[c] = map(lower, lower + grain < end ? lower + grain : end);
+            }
+        });
+        T result = identity;
+        for(size_t c = 0; c < chunks; c++) {
+            result = combine(result, partial[c]);
+        }
+        return result;
+    }
+};
+
+/**
+ * Tasks with dependencies. A task is spawned once everything it was added
+ *   after has finished, so independent branches run concurrently.
+*/
+class TaskGraph
+{
+public:
+    typedef size_t TaskId;
+
+private:
+    struct Node {
+        TaskScheduler::Task task;
+        std::vector<TaskId> successors;
+        size_t dependencies;
+        std::atomic<size_t> remaining;
+    };
+    std::vector<std::unique_ptr<Node>> nodes;
+
+    void launch(TaskScheduler& scheduler, TaskGroup& group, TaskId id);
+
+public:
+    TaskId add(TaskScheduler::Task task, const std::vector<TaskId>& after = std::vector<TaskId>());
+    void run(TaskScheduler& scheduler);
+    void clear();
+};
+
+/**
+ * Grain that splits count items into several chunks per thread so uneven
+ *   work can be stolen, but no smaller than minGrain, and into a single
+ *   chunk when only one thread is asked for.
+ */
+inline size_t stealingGrain(size_t count, unsigned nThreads, size_t minGrain)
+{
+    const size_t CHUNKS_PER_THREAD = 8;
+    if(nThreads <= 1) {
+        return count > 0 ? count : 1;
+    }
+    const size_t grain = count / (nThreads * CHUNKS_PER_THREAD);
+    return grain > minGrain ? grain : minGrain;
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include <atomic>
+
+/**
+ * Lock-free single-producer, single-consumer triple buffer. The writer
+ *   fills its back buffer and publishes it by swapping it with the middle
+ *   slot; the reader takes the middle slot whenever a fresh one is waiting.
+ *   Neither side ever blocks, the writer never touches the buffer being
+ *   read, and the reader always gets the most recent complete state.
+*/
+template <typename T>
+class TripleBuffer
+{
+    static const unsigned FRESH = 4;
+
+    T buffers[3];
+    std::atomic<unsigned> middle;   // index of the middle buffer, plus FRESH once published
+    unsigned back, front;
+
+public:
+    TripleBuffer() : middle(1), back(0), front(2) {}
+
+    T& writeBuffer()
+    {
+        return buffers[back];
+    }
+
+    void publish()
+    {
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+    }
+
+    // Returns true if a newer state was picked up
+    bool acquire()
+    {
+        if(!(middle.load(std::memory_order_acquire) & FRESH)) {
+            return false;
+        }
+        front = middle.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+        return true;
+    }
+
+    const T& readBuffer() const
+    {
+        return buffers[front];
+    }
+};
+
+#endif
@@ -3,6 +3,7 @@
 #include <cmath>
 #include <camera.hpp>
 #include <entity.hpp>
+#include <framegraph.hpp>
 #include <spheremanager.hpp>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -32,7 +33,11 @@ const GLuint SCR_HEIGHT = 1600;
 
 const char *WINDOW_TITLE = "Gravity";
 const char *VERTEX_PATH = "shaders/shader.vs";
+const char *IMPOSTOR_VERTEX_PATH = "shaders/impostor.vs";
 const char *FRAG_PATH = "shaders/shader.fs";
+const char *POINT_VERTEX_PATH = "shaders/point.vs";
+const char *POINT_FRAG_PATH = "shaders/point.fs";
+const char *CULL_COMPUTE_PATH = "shaders/cull.comp";
 
 // Gravitational constant (scaled by 10^18) N * m^2 / kg^2
 // FOV
@@ -42,6 +47,9 @@ const float FOV = 85;
 const float NEAR = 0.01f;
 const float FAR = 5000;
 
+// How many frames the frame time is averaged over
+const uint64_t FRAME_REPORT_INTERVAL = 600;
+
 // Starting camera position
 glm::vec3 cameraPosition(0.0, 0.0, 0.0);
 glm::mat4 cameraOrientation = glm::rotate(glm::mat4(1.0), glm::radians(0.0f), glm::vec3(0.0, 1.0, 0.0));
@@ -52,6 +60,22 @@ Input keyCursorInput(SCR_WIDTH, SCR_HEIGHT);
 // Camera rotation globals
 Camera camera(keyCursorInput, cameraPosition, cameraOrientation);
 
+// Projection for the framebuffer's current size, and its height in pixels;
+//   rebuilt on every resize and picked up by the next frame's input stage
+glm::mat4 windowProjection(1.0);
+float windowHeight = SCR_HEIGHT;
+
+void resizeProjection(int width, int height)
+{
+    // A minimized window has no size to project onto
+    if(width <= 0 || height <= 0) {
+        return;
+    }
+    windowProjection = glm::perspective(glm::radians(FOV), (float) width / (float) height, NEAR, FAR);
+    //windowProjection = glm::ortho(0.0f, (float) width, 0.0f, (float) height, NEAR, FAR);
+    windowHeight = height;
+}
+
 void configureWindowHints()
 {
     // glfw: configure window hints
@@ -92,6 +116,7 @@ void framebufferSizeCallback(GLFWwindow* window, int width, int height)
     // Specify location of the lower left corner of the first (x, y), then
     //   the dimensions
     glViewport(0, 0, width, height);
+    resizeProjection(width, height);
 }
 
 void gravitateCamera(SphereManager& sphereManager, float G, float duration)
@@ -99,16 +124,15 @@ void gravitateCamera(SphereManager& sphereManager, float G, float duration)
     glm::vec3 position = camera.getPosition();
     glm::vec3 velocity = camera.getVelocity();
     glm::vec3 acceleration(0.0f);
-    std::vector<float> masses = sphereManager.getMasses();
-    std::vector<glm::vec3> locations = sphereManager.getLocations();
+    const ParticleView particles = sphereManager.getParticles();
     glm::vec3 diff, norm;
     float len, k;
-    for(int i = 0; i < (int) locations.size(); i++) {
-        diff = -(locations[i] + position);
+    for(int i = 0; i < (int) particles.count; i++) {
+        diff = -(particles.location(i) + position);
         len = glm::length(diff);
         norm = diff / len;
         k = G / (len * len);
-        acceleration += masses[i] * k * norm;
+        acceleration += particles.mass[i] * k * norm;
     }
     velocity += duration * acceleration;
     position += duration * velocity;
@@ -181,11 +205,16 @@ int main(int argc, char* argv[])
     // Wireframe mode (must be called after gladLoadGLLoader
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
-    SphereManager sphereManager(VERTEX_PATH, FRAG_PATH);
+    SphereManager sphereManager(VERTEX_PATH, IMPOSTOR_VERTEX_PATH, FRAG_PATH, POINT_VERTEX_PATH, POINT_FRAG_PATH, CULL_COMPUTE_PATH);
 
     //const unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
     std::default_random_engine rand_engine(paramManager.getRandSeed());
     sphereManager.initializeSpheres(rand_engine, paramManager);
+    // Physics runs on its own thread from here on, paused until Z is toggled
+    sphereManager.startPhysics();
+    // P flips between point sprites and the configured sphere rendering;
+    //   sprites are the default past the body-count threshold
+    const bool pointSpritesByDefault = sphereManager.getPointSprites();
 
     // TODO: FIND APPROPRIATE ABSTRACTION
     // Vertices for laser beams
@@ -194,27 +223,51 @@ int main(int argc, char* argv[])
     glm::mat4 view(1.0); // The view (camera)
 
     glm::mat4 projection(1.0); // Orthographic or perspective projection
-    projection = glm::perspective(glm::radians(FOV), (float) SCR_WIDTH / (float) SCR_HEIGHT, NEAR, FAR);
-    //projection = glm::ortho(0.0f, (float) SCR_WIDTH, 0.0f, (float) SCR_HEIGHT, NEAR, FAR);
+    // What the frame being started projects with, as the input stage found it
+    glm::mat4 frameProjection(1.0);
+    float frameViewportHeight = SCR_HEIGHT;
+    int framebufferWidth, framebufferHeight;
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    resizeProjection(framebufferWidth, framebufferHeight);
 
     // Maintain rotation speed
     float prev = (float) glfwGetTime();
-    float next, duration;
+    float next, duration = 0.0f;
 
     // ############### //
     // ## Main Loop ## //
     float accumulator = 0;
-
-    while(!glfwWindowShouldClose(window)) {
+    float reportTime = prev;
+
+    // Each frame is a graph of stages ordered by the data they touch. The
+    //   render state, the view and projection it was culled from and the
+    //   instance region it fills have a copy per frame in flight, and only
+    //   the stages up to camera gravity touch the camera, so the next frame's
+    //   input, camera gravity and interpolation run while this frame is still
+    //   being drawn and presented. Instance regions come from a fenced ring: the draw
+    //   maps a fresh region for its copy, for the frame after next.
+    FrameGraph frameGraph(TaskScheduler::shared());
+    frameGraph.addResource("timing");
+    frameGraph.addResource("camera");
+    frameGraph.addResource("view", RENDER_STATE_COUNT);
+    frameGraph.addResource("snapshot");
+    frameGraph.addResource("renderState", RENDER_STATE_COUNT);
+    frameGraph.addResource("instances", RENDER_STATE_COUNT);
+    frameGraph.addResource("framebuffer");
+    glm::mat4 views[RENDER_STATE_COUNT];
+    glm::mat4 projections[RENDER_STATE_COUNT];
+    float viewportHeights[RENDER_STATE_COUNT];
+
+    frameGraph.addStage("input", FrameThread::Main, {}, {"timing", "camera"}, [&](uint64_t) {
         // Adjust camera position and orientation as needed
         camera.updateCameraOrientation(duration);
         camera.updatePositionRegular(duration);
-        view = camera.getView();
-        
         keyCursorInput.resetDiff();
 
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glClearColor(0.0f, 0.01, 0.01, 1.0f);
+        // Resizes arrive while presenting, so the frame takes the projection
+        //   as it stood when it began
+        frameProjection = windowProjection;
+        frameViewportHeight = windowHeight;
 
         next = (float) glfwGetTime();
         duration = next - prev;
@@ -222,21 +275,58 @@ int main(int argc, char* argv[])
         if(keyCursorInput.isToggled(GLFW_KEY_Z)) {
             // Increase total elapsed time if Z toggled
             accumulator += duration;
-            sphereManager.gravitateSerialAbsorbCollisions(duration);
         }
+        sphereManager.setPaused(!keyCursorInput.isToggled(GLFW_KEY_Z));
+        sphereManager.setPointSprites(pointSpritesByDefault != keyCursorInput.isToggled(GLFW_KEY_P));
+    });
+    frameGraph.addStage("gravitateCamera", FrameThread::Worker, {"timing", "snapshot"}, {"camera", "view"}, [&](uint64_t frame) {
         gravitateCamera(sphereManager, paramManager.getGravitationalConstant(), duration);
+        views[frame % RENDER_STATE_COUNT] = camera.getView();
+        projections[frame % RENDER_STATE_COUNT] = frameProjection;
+        viewportHeights[frame % RENDER_STATE_COUNT] = frameViewportHeight;
+    });
+    // Culled and given levels of detail from the view the draw will use,
+    //   the one after the camera has fallen this frame
+    frameGraph.addStage("interpolate", FrameThread::Worker, {"view"}, {"snapshot", "renderState", "instances"}, [&](uint64_t frame) {
+        const unsigned slot = frame % RENDER_STATE_COUNT;
+        sphereManager.updateRenderState(slot, views[slot], projections[slot], viewportHeights[slot]);
+    });
+    frameGraph.addStage("draw", FrameThread::Main, {"renderState"}, {"instances", "framebuffer"}, [&](uint64_t frame) {
+        const unsigned slot = frame % RENDER_STATE_COUNT;
+        view = sphereManager.getRenderView(slot);
+        projection = sphereManager.getRenderProjection(slot);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glClearColor(0.0f, 0.01, 0.01, 1.0f);
+
         sphereManager.bindVertexArray();
-        sphereManager.setShaderUniforms(view, projection);
-        sphereManager.useShader();
+        sphereManager.bindInstances(slot);
+        sphereManager.cullInstances(view, projection, slot);
+        sphereManager.setShaderUniforms(view, projection, slot);
+        sphereManager.useShader(slot);
 
-        glDrawElementsInstanced(GL_TRIANGLES, sphereManager.getIndices().size(), GL_UNSIGNED_INT, 0, sphereManager.getSphereCount());
+        sphereManager.drawInstances(slot);
+        sphereManager.fenceInstances(slot);
 
         //std::cout << glGetError() << std::endl;
-
+    });
+    frameGraph.addStage("present", FrameThread::Main, {}, {"framebuffer"}, [&](uint64_t) {
         glfwSwapBuffers(window);
         glfwPollEvents();
+    });
+    frameGraph.addStage("diagnostics", FrameThread::Worker, {"timing"}, {}, [&](uint64_t frame) {
+        if(frame % FRAME_REPORT_INTERVAL == 0 && frame > 0) {
+            std::cout << "Average frame time: " << 1000.0f * (next - reportTime) / FRAME_REPORT_INTERVAL << " ms" << std::endl;
+            std::cout << "Average instance fence stall: " << 1000.0 * sphereManager.takeAverageFenceStall() << " ms" << std::endl;
+            reportTime = next;
+        }
+    });
+
+    while(!glfwWindowShouldClose(window)) {
+        frameGraph.runFrame();
     }
+    frameGraph.finish();
 
+    sphereManager.stopPhysics();
     glfwTerminate();
     return 0;
 }
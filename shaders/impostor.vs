@@ -0,0 +1,55 @@
+#version 450 core
+
+// Drawn as a 4-vertex triangle strip per instance; the corners come from
+//   gl_VertexID, so the mesh attributes are ignored
+layout (location = 2) in vec3 aLocation; // per instance, scaled by instanceExtent
+layout (location = 3) in uint aIndex;    // per instance, the sphere drawn
+
+out vec3 quadPos;
+out flat vec3 instanceCenter;
+out flat vec3 cameraPosition;
+out flat vec4 instanceColor;
+out flat float instanceRadius;
+
+uniform mat4 projection;
+uniform mat4 view;
+// Per sphere: packed RGBA8 color (alpha set for light sources), radius bits
+uniform usamplerBuffer sphereAttributes;
+// Box the instance locations are given in: the origin and unit box for
+//   plain floats, the frame's bounding box for 16-bit fixed point
+uniform vec3 instanceOrigin = vec3(0.0);
+uniform vec3 instanceExtent = vec3(1.0);
+
+void main()
+{
+    uvec2 attributes = texelFetch(sphereAttributes, int(aIndex)).xy;
+    float radius = uintBitsToFloat(attributes.y);
+    vec3 center = instanceOrigin + instanceExtent * aLocation;
+
+    // The camera's world position and axes, from the rows of the view
+    //   rotation
+    mat3 rotation = transpose(mat3(view));
+    vec3 camera = -(rotation * view[3].xyz);
+    vec3 cameraRight = rotation[0];
+    vec3 cameraUp = rotation[1];
+
+    // A square through the center, facing the camera, just wide enough to
+    //   hold the cone of rays that touch the sphere. With the camera inside
+    //   the sphere there is no outline to draw, so the quad collapses.
+    vec3 toCenter = center - camera;
+    float distance2 = dot(toCenter, toCenter);
+    vec3 forward = toCenter * inversesqrt(distance2);
+    vec3 right = cross(forward, cameraUp);
+    right = dot(right, right) > 1e-12 ? normalize(right) : cameraRight;
+    vec3 up = cross(right, forward);
+    float halfSize = distance2 > radius * radius ? radius * sqrt(distance2 / (distance2 - radius * radius)) : 0.0;
+
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    vec3 location = center + halfSize * (corner.x * right + corner.y * up);
+    gl_Position = projection * view * vec4(location, 1.0);
+    quadPos = location;
+    instanceCenter = center;
+    cameraPosition = camera;
+    instanceColor = unpackUnorm4x8(attributes.x);
+    instanceRadius = radius;
+}
@@ -0,0 +1,28 @@
+#version 450 core
+out vec4 FragColor;
+
+in flat vec4 instanceColor;
+
+uniform vec3 ambientColor = vec3(1.0);
+
+void main()
+{
+    // Round sprites: drop the corners of the point's square
+    vec2 offset = 2.0 * gl_PointCoord - 1.0;
+    float distance2 = dot(offset, offset);
+    if(distance2 > 1.0) {
+        discard;
+    }
+
+    // Blended with (1, 1 - source alpha): bodies are opaque, while light
+    //   sources have zero alpha and add a glow that fades to the edge. The
+    //   glows are drawn last without writing depth, so they don't hide each
+    //   other.
+    vec3 color = instanceColor.rgb * ambientColor;
+    if(instanceColor.a == 0.0) {
+        FragColor = vec4(color, 1.0);
+    }
+    else {
+        FragColor = vec4(color * (1.0 - distance2), 0.0);
+    }
+}
@@ -0,0 +1,41 @@
+#version 450 core
+
+// One point per instance, drawn without the mesh or an index buffer
+layout (location = 2) in vec3 aLocation; // per instance, scaled by instanceExtent
+layout (location = 3) in uint aIndex;    // per instance, the sphere drawn
+
+out flat vec4 instanceColor;
+
+uniform mat4 projection;
+uniform mat4 view;
+// Per sphere: packed RGBA8 color (alpha set for light sources), radius bits
+uniform usamplerBuffer sphereAttributes;
+// Box the instance locations are given in: the origin and unit box for
+//   plain floats, the frame's bounding box for 16-bit fixed point
+uniform vec3 instanceOrigin = vec3(0.0);
+uniform vec3 instanceExtent = vec3(1.0);
+// Pixels a unit of radius covers at unit depth
+uniform float pointScale = 1.0;
+// Light sources glow past their outline by this factor
+uniform float lightGlow = 2.0;
+// Bodies are drawn in one pass and light sources in another, so each draw
+//   places only its own and clips the rest
+uniform bool glowPass = false;
+
+void main()
+{
+    uvec2 attributes = texelFetch(sphereAttributes, int(aIndex)).xy;
+    float radius = uintBitsToFloat(attributes.y);
+    vec4 location = view * vec4(instanceOrigin + instanceExtent * aLocation, 1.0);
+    gl_Position = projection * location;
+    instanceColor = unpackUnorm4x8(attributes.x);
+
+    // The sphere's diameter on screen, never less than a pixel so distant
+    //   bodies don't vanish
+    float depth = max(-location.z, 1e-3);
+    float glow = instanceColor.a > 0.0 ? lightGlow : 1.0;
+    gl_PointSize = max(2.0 * glow * radius * pointScale / depth, 1.0);
+    if((instanceColor.a > 0.0) != glowPass) {
+        gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+    }
+}
@@ -1,28 +1,36 @@
-#version 460 core
-#define NUM_ENTITIES __NUM_ENTITIES__
-#define NUM_LIGHT_SOURCES __NUM_LIGHT_SOURCES__
+#version 450 core
+// 1 when drawn behind impostor.vs: the surface point and normal then come
+//   from a ray cast against the sphere instead of a mesh
+#define IMPOSTORS IMPOSTOR_MODE
+
 out vec4 FragColor;
 
+#if IMPOSTORS
+in vec3 quadPos;
+in flat vec3 instanceCenter;
+in flat vec3 cameraPosition;
+
+// The hit is never behind the quad, which keeps early depth rejection
+layout (depth_less) out float gl_FragDepth;
+
+uniform mat4 projection;
+uniform mat4 view;
+#else
 in vec3 ourPos;
 in vec3 ourNorm;
-in flat int instanceID;
+#endif
+in flat vec4 instanceColor;
+in flat float instanceRadius;
 
 uniform sampler2D ourTexture;
-uniform bool isLightSource[NUM_ENTITIES];
-#if NUM_LIGHT_SOURCES > 0
-uniform int lightSourceIndices[NUM_LIGHT_SOURCES];
-#else 
-uniform int lightSourceIndices[1] = {0};
-#endif
+
+// Two texels per light source: location and radius, then color
+uniform samplerBuffer lights;
 
 uniform vec3 ambientColor = vec3(1.0);
 
 // Number of remaining lights that have not been consumed
-uniform int remainingLights = NUM_ENTITIES;
-
-uniform vec3 modelColors[NUM_ENTITIES];
-uniform vec3 locations[NUM_ENTITIES];
-uniform float radii[NUM_ENTITIES];
+uniform int remainingLights = 0;
 
 // A single iteration of Bob Jenkins' One-At-A-Time hashing algorithm.
 uint hash( uint x ) {
@@ -59,12 +67,38 @@ float rand(float a, float b, uint m)
     return (b - a) * floatConstruct(m) + a;
 }
 
+#if IMPOSTORS
+// Nearest intersection of the ray from the camera through this fragment
+//   with the sphere, and the depth it sits at; false where the ray misses
+bool castRay(out vec3 hit, out vec3 normal)
+{
+    vec3 direction = normalize(quadPos - cameraPosition);
+    vec3 toCenter = instanceCenter - cameraPosition;
+    float b = dot(direction, toCenter);
+    float discriminant = b * b - dot(toCenter, toCenter) + instanceRadius * instanceRadius;
+    if(discriminant < 0.0) {
+        return false;
+    }
+    hit = cameraPosition + (b - sqrt(discriminant)) * direction;
+    normal = (hit - instanceCenter) / instanceRadius;
+    vec4 clip = projection * view * vec4(hit, 1.0);
+    gl_FragDepth = 0.5 * (gl_DepthRange.diff * clip.z / clip.w + gl_DepthRange.near + gl_DepthRange.far);
+    return true;
+}
+#endif
+
 void main()
 {
+#if IMPOSTORS
+    vec3 ourPos, ourNorm;
+    if(!castRay(ourPos, ourNorm)) {
+        discard;
+    }
+#endif
     // attenuation coefficient
     float k = 0.0001; 
     vec3 diffuse = vec3(0.0);
-    vec3 ourColor = modelColors[instanceID];
+    vec3 ourColor = instanceColor.rgb;
 
     // ambient light strength
     float ambientStrength = .2;
@@ -72,16 +106,17 @@ void main()
 
     // Combine the texture with the positional color scheme
 
-    if(!isLightSource[instanceID]) {
+    if(instanceColor.w == 0.0) {
         // Compute diffuse lighting from light sources
         vec3 difference = vec3(1.0);
         for(int i = 0; i < remainingLights; i++) {
-            vec3 loc = locations[lightSourceIndices[i]];
-            difference = loc - ourPos;
-            float len = length(difference) - radii[i] - radii[instanceID];
+            vec4 light = texelFetch(lights, 2 * i);
+            vec3 lightColor = texelFetch(lights, 2 * i + 1).rgb;
+            difference = light.xyz - ourPos;
+            float len = length(difference) - light.w - instanceRadius;
             //float len = length(difference);
             float preDiffuse = max(dot(normalize(difference), ourNorm), 0.0);
-            diffuse += 1 / (1 + k * len * len) * preDiffuse * ambientColor * modelColors[lightSourceIndices[i]];
+            diffuse += 1 / (1 + k * len * len) * preDiffuse * ambientColor * lightColor;
         }
         FragColor = vec4(ourColor * (ambient + diffuse), 1.0f);
     } 
@@ -1,26 +1,36 @@
-#version 460 core
-#define NUM_ENTITIES __NUM_ENTITIES__
+#version 450 core
 
 layout (location = 0) in vec3 aPos;      // position has attribute position 0
 layout (location = 1) in vec3 aNorm;     // normal vectors for sphere surface
+layout (location = 2) in vec3 aLocation; // per instance, scaled by instanceExtent
+layout (location = 3) in uint aIndex;    // per instance, the sphere drawn
 
 out vec3 ourPos;
 out vec3 ourNorm;
 out vec2 TexCoord;
-out flat int instanceID;
+out flat vec4 instanceColor;
+out flat float instanceRadius;
 
 uniform mat4 projection;
 uniform mat4 view;
-uniform mat4 models[NUM_ENTITIES];
-uniform mat3 normals[NUM_ENTITIES];
+// Per sphere: packed RGBA8 color (alpha set for light sources), radius bits
+uniform usamplerBuffer sphereAttributes;
+// Box the instance locations are given in: the origin and unit box for
+//   plain floats, the frame's bounding box for 16-bit fixed point
+uniform vec3 instanceOrigin = vec3(0.0);
+uniform vec3 instanceExtent = vec3(1.0);
 
 void main()
 {
-    mat4 instanceModel = models[gl_InstanceID];
-    vec4 location = instanceModel * vec4(aPos, 1.0);
+    // A unit sphere scaled by the radius and moved to the location; the
+    //   scale is uniform, so the normals need no transform
+    uvec2 attributes = texelFetch(sphereAttributes, int(aIndex)).xy;
+    float radius = uintBitsToFloat(attributes.y);
+    vec3 center = instanceOrigin + instanceExtent * aLocation;
+    vec4 location = vec4(center + radius * aPos, 1.0);
     gl_Position = projection * view * location;
-    //gl_Position = projection * view * instanceModel * vec4(aNormal * 1000, 1.0);
     ourPos = vec3(location);
     ourNorm = aNorm;
-    instanceID = gl_InstanceID;
+    instanceColor = unpackUnorm4x8(attributes.x);
+    instanceRadius = radius;
 }
@@ -0,0 +1,1066 @@
+#include <barneshut.hpp>
+#include <directkernel.hpp>
+#include <entity.hpp>
+#include <fastmultipole.hpp>
+#include <framegraph.hpp>
+#include <frustum.hpp>
+#include <hermite.hpp>
+#include <instancewriter.hpp>
+#include <integrator.hpp>
+#include <particlemesh.hpp>
+#include <particlestore.hpp>
+#include <spatialhash.hpp>
+#include <spheremerger.hpp>
+#include <taskscheduler.hpp>
+#include <triplebuffer.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+const float G = 6.674f;
+const int BODY_COUNT = 2000;
+
+void makeBodies(ParticleStore& particles)
+{
+    std::default_random_engine randEngine(23);
+    std::normal_distribution<float> locations_dist(0, 200);
+    std::uniform_real_distribution<float> mass_dist(1, 100);
+    for(int i = 0; i < BODY_COUNT; i++) {
+        glm::vec3 location(locations_dist(randEngine), locations_dist(randEngine), locations_dist(randEngine));
+        particles.push_back(location, glm::vec3(0.0f), mass_dist(randEngine), 0.01f);
+    }
+}
+
+std::vector<glm::vec3> directAccelerations(const ParticleView& particles)
+{
+    std::vector<glm::vec3> accelerations(particles.count, glm::vec3(0.0f));
+    for(size_t i = 0; i < particles.count; i++) {
+        for(size_t j = 0; j < particles.count; j++) {
+            if(i == j) continue;
+            glm::vec3 diff = particles.location(j) - particles.location(i);
+            float len = glm::length(diff);
+            accelerations[i] += G * particles.mass[j] / (len * len * len) * diff;
+        }
+    }
+    return accelerations;
+}
+
+// RMS of |a - a_ref| relative to the RMS of |a_ref|
+float relativeError(const AccelerationView& approx, const std::vector<glm::vec3>& exact)
+{
+    double err = 0, norm = 0;
+    for(size_t i = 0; i < exact.size(); i++) {
+        glm::vec3 diff = approx.get(i) - exact[i];
+        err += glm::dot(diff, diff);
+        norm += glm::dot(exact[i], exact[i]);
+    }
+    return std::sqrt(err / norm);
+}
+
+int test_particle_store()
+{
+    ParticleStore particles;
+    for(int i = 0; i < 20; i++) {
+        particles.push_back(glm::vec3(i), glm::vec3(0.0f), i + 1.0f, 1.0f);
+    }
+    const float* arrays[] = { particles.x.data(), particles.vx.data(), particles.ax.data(), particles.mass.data() };
+    for(const float* array : arrays) {
+        if(reinterpret_cast<uintptr_t>(array) % PARTICLE_ALIGNMENT != 0) {
+            return 1;
+        }
+    }
+    // Padding lanes must be massless so a vector loop can run over them
+    ParticleView view = particles.view();
+    if(view.paddedCount != 32 || view.paddedCount % PARTICLE_SIMD_WIDTH != 0) {
+        return 1;
+    }
+    for(size_t i = view.count; i < view.paddedCount; i++) {
+        if(view.mass[i] != 0.0f) {
+            return 1;
+        }
+    }
+    // Erasing keeps order and shrinks back to one SIMD block
+    for(int i = 0; i < 5; i++) {
+        particles.erase(0);
+    }
+    view = particles.view();
+    if(view.count != 15 || view.paddedCount != 16 || view.location(0) != glm::vec3(5.0f) || view.mass[15] != 0.0f) {
+        return 1;
+    }
+    // Batched removal of every other particle in one pass
+    std::vector<char> removed(particles.size(), 0);
+    for(size_t i = 0; i < removed.size(); i += 2) {
+        removed[i] = 1;
+    }
+    particles.compact(removed);
+    view = particles.view();
+    if(view.count != 7 || view.location(0) != glm::vec3(6.0f) || view.location(6) != glm::vec3(18.0f) || view.mass[7] != 0.0f) {
+        return 1;
+    }
+    // Re-homing the arrays must not change their contents
+    particles.firstTouch(TaskScheduler::shared());
+    view = particles.view();
+    if(view.count != 7 || view.location(0) != glm::vec3(6.0f) || view.location(6) != glm::vec3(18.0f) || view.mass[7] != 0.0f) {
+        return 1;
+    }
+    // Also when the static blocks split the arrays mid-page
+    ParticleStore many;
+    for(int i = 0; i < 50001; i++) {
+        many.push_back(glm::vec3((float) i), glm::vec3(0.0f), 1.0f + i, 1.0f);
+    }
+    TaskScheduler scheduler(3);
+    scheduler.setStaticPartition(true);
+    many.firstTouch(scheduler);
+    view = many.view();
+    for(size_t i = 0; i < view.paddedCount; i++) {
+        const bool real = i < view.count;
+        if(view.mass[i] != (real ? 1.0f + i : 0.0f) || (real && view.location(i) != glm::vec3((float) i))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int test_direct_kernel()
+{
+    ParticleStore particles;
+    makeBodies(particles);
+    std::vector<glm::vec3> exact = directAccelerations(particles.view());
+
+    // Every instruction set this CPU can run has to agree with the reference
+    DirectKernel kernel;
+    const SimdLevel best = kernel.getLevel();
+    for(int level = (int) SimdLevel::Scalar; level <= (int) best; level++) {
+        kernel.setLevel((SimdLevel) level);
+        auto start = std::chrono::steady_clock::now();
+        bool contact = kernel.computeAccelerations(particles.view(), G, particles.accelerations(), 1);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        float error = relativeError(particles.accelerations(), exact);
+        std::cout << "Direct kernel " << simdLevelName(kernel.getLevel()) << " error: " << error
+                  << " (" << elapsed.count() << " ms)" << std::endl;
+        if(contact || error > 1e-5) {
+            return 1;
+        }
+    }
+
+    // Overlapping spheres are reported and exert no force on each other
+    ParticleStore pair;
+    pair.push_back(glm::vec3(0.0f), glm::vec3(0.0f), 1.0f, 1.0f);
+    pair.push_back(glm::vec3(1.5f, 0.0f, 0.0f), glm::vec3(0.0f), 1.0f, 1.0f);
+    kernel.setLevel(best);
+    if(!kernel.computeAccelerations(pair.view(), G, pair.accelerations(), 1) || pair.acceleration(0) != glm::vec3(0.0f)) {
+        return 1;
+    }
+    return 0;
+}
+
+int test_parallel_direct()
+{
+    // The same seeded system stepped with the direct kernel on one thread
+    //   and on the scheduler's workers has to follow the same trajectories
+    ParticleStore systems[2];
+    const unsigned threads[2] = { 1, TaskScheduler::shared().getThreadCount() };
+    DirectKernel kernel;
+    for(int k = 0; k < 2; k++) {
+        makeBodies(systems[k]);
+        Integrator integrator(IntegrationScheme::Leapfrog);
+        ParticleStore& particles = systems[k];
+        for(int step = 0; step < 20; step++) {
+            integrator.step(particles, 0.01f, [&]() {
+                kernel.computeAccelerations(particles.view(), G, particles.accelerations(), threads[k]);
+            });
+        }
+    }
+    float locationError = 0.0f, velocityError = 0.0f;
+    for(size_t i = 0; i < systems[0].size(); i++) {
+        const glm::vec3 location = systems[0].location(i), velocity = systems[0].velocity(i);
+        locationError = std::max(locationError, glm::length(systems[1].location(i) - location) / std::max(glm::length(location), 1.0f));
+        velocityError = std::max(velocityError, glm::length(systems[1].velocity(i) - velocity) / std::max(glm::length(velocity), 1.0f));
+    }
+    std::cout << "Parallel direct vs serial, " << threads[1] << " threads: location " << locationError
+              << ", velocity " << velocityError << std::endl;
+    if(locationError > 1e-5f || velocityError > 1e-4f) {
+        return 1;
+    }
+    return 0;
+}
+
+int test_spatial_hash()
+{
+    // A dense cluster with mixed radii, so plenty of pairs overlap
+    ParticleStore particles;
+    std::default_random_engine randEngine(5);
+    std::normal_distribution<float> locations_dist(0, 50);
+    std::uniform_real_distribution<float> radii_dist(0.5, 8);
+    for(int i = 0; i < BODY_COUNT; i++) {
+        glm::vec3 location(locations_dist(randEngine), locations_dist(randEngine), locations_dist(randEngine));
+        particles.push_back(location, glm::vec3(0.0f), 1.0f, radii_dist(randEngine));
+    }
+    std::vector<ContactPair> exact;
+    for(unsigned i = 0; i < particles.size(); i++) {
+        for(unsigned j = i + 1; j < particles.size(); j++) {
+            glm::vec3 d = particles.location(j) - particles.location(i);
+            float s = particles.radius[i] + particles.radius[j];
+            if(glm::dot(d, d) <= s * s) {
+                exact.push_back(ContactPair(i, j));
+            }
+        }
+    }
+
+    SpatialHash hash;
+    for(unsigned nThreads = 1; nThreads <= 4; nThreads *= 4) {
+        const std::vector<ContactPair>& contacts = hash.findContacts(particles.view(), nThreads);
+        std::cout << "Spatial hash contacts: " << contacts.size() << " of " << exact.size()
+                  << " with " << nThreads << " thread(s)" << std::endl;
+        if(contacts != exact) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int test_sphere_merger()
+{
+    // Survivors are 1 (chain 0-2-1), 3 (light beats the larger 4),
+    //   5 (ties with 6 on radius, lower index) and the untouched 7 and 8
+    const float radii[] = {1, 3, 2, 1, 5, 2, 2, 1, 1};
+    const float masses[] = {1, 8, 2, 1, 3, 4, 5, 1, 1};
+    const int lights[] = {0, 0, 0, 1, 0, 0, 0, 1, 0};
+    ParticleStore particles;
+    std::vector<glm::vec3> colors;
+    std::vector<int> isLightSource, lightSourceIndices;
+    float totalMass = 0.0f;
+    glm::vec3 totalMomentum(0.0f);
+    for(int i = 0; i < 9; i++) {
+        glm::vec3 velocity(i, 1.0f - i, 0.5f * i * i);
+        particles.push_back(glm::vec3(10.0f * i, 0.0f, 0.0f), velocity, masses[i], radii[i]);
+        colors.push_back(glm::vec3(i));
+        isLightSource.push_back(lights[i]);
+        if(lights[i]) {
+            lightSourceIndices.push_back(i);
+        }
+        totalMass += masses[i];
+        totalMomentum += masses[i] * velocity;
+    }
+    // 2 absorbs 0 before 1 absorbs 2, so the chain only resolves via the roots
+    std::vector<ContactPair> contacts = {ContactPair(0, 2), ContactPair(1, 2), ContactPair(3, 4), ContactPair(5, 6)};
+
+    const float density = 0.5f;
+    SphereMerger merger;
+    merger.merge(particles, colors, isLightSource, lightSourceIndices, contacts, density);
+
+    const unsigned survivors[] = {1, 3, 5, 7, 8};
+    const float mergedMass[] = {11, 4, 9, 1, 1};
+    float mass = 0.0f;
+    glm::vec3 momentum(0.0f);
+    bool ok = particles.size() == 5 && colors.size() == 5 && isLightSource.size() == 5
+              && lightSourceIndices == std::vector<int>({1, 3});
+    for(unsigned i = 0; ok && i < 5; i++) {
+        unsigned original = survivors[i];
+        float radius = mergedMass[i] == masses[original] ? radii[original]
+                       : std::cbrt(3.0f * mergedMass[i] / (4.0f * M_PI * density));
+        ok = colors[i] == glm::vec3(original) && isLightSource[i] == lights[original]
+             && particles.location(i) == glm::vec3(10.0f * original, 0.0f, 0.0f)
+             && particles.mass[i] == mergedMass[i] && std::fabs(particles.radius[i] / radius - 1.0f) < 1e-5f;
+        mass += particles.mass[i];
+        momentum += particles.mass[i] * particles.velocity(i);
+    }
+    float momentumError = glm::length(momentum - totalMomentum) / glm::length(totalMomentum);
+    std::cout << "Sphere merger: " << particles.size() << " survivors, mass " << mass << " of " << totalMass
+              << ", momentum error " << momentumError << std::endl;
+    if(!ok || mass != totalMass || momentumError > 1e-6f) {
+        return 1;
+    }
+    return 0;
+}
+
+// A snapshot at rest at the given locations, with no light sources
+void makeSnapshot(PhysicsSnapshot& snapshot, const std::vector<glm::vec3>& locations, float radius)
+{
+    snapshot.count = locations.size();
+    for(const glm::vec3& location : locations) {
+        snapshot.x.push_back(location.x);
+        snapshot.y.push_back(location.y);
+        snapshot.z.push_back(location.z);
+        snapshot.mass.push_back(1.0f);
+        snapshot.radius.push_back(radius);
+        snapshot.colors.push_back(glm::vec3(1.0f));
+        snapshot.isLightSource.push_back(0);
+    }
+    snapshot.previousX = snapshot.x;
+    snapshot.previousY = snapshot.y;
+    snapshot.previousZ = snapshot.z;
+    snapshot.version = snapshot.attributeVersion = 1;
+}
+
+int test_instance_format()
+{
+    // Spheres spread over a 100-wide box in a plane, so z is a degenerate axis
+    std::default_random_engine randEngine(11);
+    std::uniform_real_distribution<float> location_dist(-50, 50);
+    std::vector<glm::vec3> locations(1000);
+    for(glm::vec3& location : locations) {
+        location = glm::vec3(location_dist(randEngine), location_dist(randEngine), 5.0f);
+    }
+    std::vector<SphereInstance> region(locations.size());
+    RenderState state;
+
+    // Meshes culled on the GPU are written in sphere order
+    PhysicsSnapshot snapshot;
+    makeSnapshot(snapshot, locations, 1.0f);
+    InstanceWriter writer;
+    writer.write(state, state, snapshot, locations.size(), 1.0f, true, region.data());
+    const CompactSphereInstance* compact = (const CompactSphereInstance*) region.data();
+    float worst = 0.0f;
+    bool ok = state.compact && state.count == locations.size() && state.extent.z == 0.0f;
+    for(size_t i = 0; ok && i < locations.size(); i++) {
+        glm::vec3 decoded;
+        for(int k = 0; k < 3; k++) {
+            decoded[k] = state.origin[k] + state.extent[k] * compact[i].location[k] / FIXED_MAX;
+        }
+        worst = std::max(worst, glm::length(decoded - locations[i]));
+        ok = compact[i].index == i && compact[i].location[2] == 0 && decoded.z == 5.0f;
+    }
+    std::cout << "Compact instances: worst error " << worst << " of " << COMPACT_TOLERANCE * 1.0f << std::endl;
+    if(!ok || worst > COMPACT_TOLERANCE * 1.0f) {
+        return 1;
+    }
+
+    // Spheres too small for 16-bit steps across the box fall back to floats
+    PhysicsSnapshot tiny;
+    makeSnapshot(tiny, locations, 1e-3f);
+    InstanceWriter fallback;
+    fallback.write(state, state, tiny, locations.size(), 1.0f, true, region.data());
+    ok = !state.compact && state.count == locations.size();
+    for(size_t i = 0; ok && i < locations.size(); i++) {
+        ok = region[i].index == i && region[i].location == locations[i];
+    }
+    std::cout << "Full instances for tiny spheres: " << (ok ? "exact" : "wrong") << std::endl;
+    return ok ? 0 : 1;
+}
+
+int test_instance_reuse()
+{
+    std::vector<glm::vec3> locations;
+    for(int i = 0; i < 100; i++) {
+        locations.push_back(glm::vec3(i % 10, i / 10, 0.0f));
+    }
+    PhysicsSnapshot snapshot;
+    makeSnapshot(snapshot, locations, 0.5f);
+    std::vector<SphereInstance> region(locations.size());
+    glm::mat4 view = glm::lookAt(glm::vec3(5.0f, 5.0f, 30.0f), glm::vec3(5.0f, 5.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 1000.0f);
+    float alpha = 1.0f;
+    bool gpuCulled = false;
+
+    // Each frame writes the other state, as the two render slots do
+    InstanceWriter writer;
+    RenderState states[2];
+    states[0].mode = states[1].mode = RenderMode::Points;
+    int frame = 0;
+    auto reused = [&]() {
+        RenderState& state = states[frame % 2];
+        const RenderState& last = states[(frame + 1) % 2];
+        state.view = view;
+        state.projection = projection;
+        state.pixelScale = 100.0f;
+        writer.write(state, last, snapshot, locations.size(), alpha, gpuCulled, region.data());
+        frame++;
+        return state.reuseInstances && state.count == last.count && state.version == last.version;
+    };
+    auto setMode = [&](RenderMode mode) {
+        states[0].mode = states[1].mode = mode;
+    };
+
+    // Each change forces a rebuild, after which the unchanged frame reuses it
+    const char* failure = nullptr;
+    if(reused() || !reused()) {
+        failure = "first frames";
+    }
+    snapshot.version++;
+    if(!failure && (reused() || !reused())) {
+        failure = "new snapshot";
+    }
+    snapshot.version++;
+    snapshot.attributeVersion++;
+    if(!failure && (reused() || !reused())) {
+        failure = "new attributes";
+    }
+    snapshot.attributeVersion++;
+    if(!failure && (reused() || !reused())) {
+        failure = "attributes alone";
+    }
+    view = glm::translate(view, glm::vec3(0.0f, 0.0f, -1.0f));
+    if(!failure && (reused() || !reused())) {
+        failure = "new view";
+    }
+    projection = glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, 1000.0f);
+    if(!failure && (reused() || !reused())) {
+        failure = "new projection";
+    }
+    setMode(RenderMode::Impostor);
+    if(!failure && (reused() || !reused())) {
+        failure = "new mode";
+    }
+    // A snapshot still being interpolated towards is rebuilt every frame
+    snapshot.version++;
+    alpha = 0.5f;
+    if(!failure && (reused() || reused())) {
+        failure = "unsettled snapshot";
+    }
+    alpha = 1.0f;
+    if(!failure && (reused() || !reused())) {
+        failure = "settled snapshot";
+    }
+    // Meshes culled on the GPU do not depend on the view
+    setMode(RenderMode::Mesh);
+    gpuCulled = true;
+    if(!failure && reused()) {
+        failure = "GPU-culled mode";
+    }
+    view = glm::translate(view, glm::vec3(0.0f, 0.0f, -1.0f));
+    if(!failure && !reused()) {
+        failure = "GPU-culled view";
+    }
+    std::cout << "Instance reuse: " << (failure ? failure : "ok") << " after " << frame << " frames" << std::endl;
+    return failure ? 1 : 0;
+}
+
+int test_instance_order()
+{
+    // Enough spheres for several chunks, all around and behind the camera
+    std::default_random_engine randEngine(19);
+    std::normal_distribution<float> location_dist(0, 300);
+    std::vector<glm::vec3> locations(20000);
+    for(glm::vec3& location : locations) {
+        location = glm::vec3(location_dist(randEngine), location_dist(randEngine), location_dist(randEngine));
+    }
+    PhysicsSnapshot snapshot;
+    makeSnapshot(snapshot, locations, 2.0f);
+    const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 400.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    const glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 5000.0f);
+    const float pixelScale = 1000.0f;
+    std::vector<unsigned char> visible(locations.size());
+    std::vector<float> depths(locations.size());
+    const size_t visibleCount = cullSpheres(Frustum(projection * view), snapshot.x.data(), snapshot.y.data(), snapshot.z.data(),
+                                            snapshot.radius.data(), locations.size(), visible.data(), depths.data());
+
+    // Meshes culled on the CPU come out by level, then front to back
+    std::vector<SphereInstance> region(locations.size());
+    RenderState state;
+    state.view = view;
+    state.projection = projection;
+    state.pixelScale = pixelScale;
+    InstanceWriter writer;
+    writer.write(state, state, snapshot, locations.size(), 1.0f, false, region.data());
+    GLuint next = 0;
+    std::vector<bool> written(locations.size(), false);
+    for(GLuint level = 0; level < SPHERE_LOD_COUNT; level++) {
+        if(state.lodFirst[level] != next) {
+            std::cout << "LOD " << level << " does not follow the one before" << std::endl;
+            return 1;
+        }
+        GLuint bucket = 0;
+        for(GLuint k = state.lodFirst[level]; k < state.lodFirst[level] + state.lodCount[level]; k++) {
+            const GLuint i = region[k].index;
+            const GLuint instanceBucket = InstanceWriter::depthBucket(depths[i]);
+            if(!visible[i] || written[i] || instanceBucket < bucket
+               || InstanceWriter::selectLod(locations[i], 2.0f, view, pixelScale) != level) {
+                std::cout << "Instance " << k << " is out of order" << std::endl;
+                return 1;
+            }
+            written[i] = true;
+            bucket = instanceBucket;
+        }
+        next += state.lodCount[level];
+    }
+    std::cout << "Instance order: " << state.count << " of " << locations.size() << " visible, " << visibleCount
+              << " expected" << std::endl;
+    return state.count == visibleCount && next == visibleCount ? 0 : 1;
+}
+
+// Largest relative energy drift of a circular two-body orbit over ten periods
+double orbitEnergyError(IntegrationScheme scheme, int stepsPerOrbit)
+{
+    const float M = 1000.0f, m = 1.0f, r = 10.0f;
+    const float v = std::sqrt(G * M / r);
+    ParticleStore particles;
+    particles.push_back(glm::vec3(0.0f), glm::vec3(0.0f, -m / M * v, 0.0f), M, 0.1f);
+    particles.push_back(glm::vec3(r, 0.0f, 0.0f), glm::vec3(0.0f, v, 0.0f), m, 0.1f);
+    auto energy = [&particles]() {
+        glm::dvec3 d = glm::dvec3(particles.location(1) - particles.location(0));
+        double kinetic = 0.0;
+        for(int i = 0; i < 2; i++) {
+            glm::dvec3 u = glm::dvec3(particles.velocity(i));
+            kinetic += 0.5 * particles.mass[i] * glm::dot(u, u);
+        }
+        return kinetic - (double) G * particles.mass[0] * particles.mass[1] / glm::length(d);
+    };
+    auto accelerations = [&particles]() {
+        glm::vec3 d = particles.location(1) - particles.location(0);
+        glm::vec3 f = G / std::pow(glm::length(d), 3.0f) * d;
+        particles.accelerations().set(0, particles.mass[1] * f);
+        particles.accelerations().set(1, -particles.mass[0] * f);
+    };
+
+    Integrator integrator(scheme);
+    const double initial = energy();
+    const float dt = 2.0f * M_PI * r / v / stepsPerOrbit;
+    double worst = 0.0;
+    for(int k = 0; k < 10 * stepsPerOrbit; k++) {
+        integrator.step(particles, dt, accelerations);
+        worst = std::max(worst, std::fabs(energy() / initial - 1.0));
+    }
+    return worst;
+}
+
+int test_integrators()
+{
+    // Each step up in order has to conserve energy better at the same dt
+    double euler = orbitEnergyError(IntegrationScheme::Euler, 40);
+    double leapfrog = orbitEnergyError(IntegrationScheme::Leapfrog, 40);
+    double yoshida = orbitEnergyError(IntegrationScheme::Yoshida, 40);
+    std::cout << "Energy drift Euler: " << euler << ", leapfrog: " << leapfrog << ", Yoshida: " << yoshida << std::endl;
+    if(leapfrog >= euler || yoshida >= leapfrog || yoshida > 1e-3) {
+        return 1;
+    }
+    return 0;
+}
+
+double totalEnergy(const ParticleStore& particles)
+{
+    double energy = 0.0;
+    for(size_t i = 0; i < particles.size(); i++) {
+        glm::dvec3 v = glm::dvec3(particles.velocity(i));
+        energy += 0.5 * particles.mass[i] * glm::dot(v, v);
+        for(size_t j = i + 1; j < particles.size(); j++) {
+            double r = glm::length(glm::dvec3(particles.location(j)) - glm::dvec3(particles.location(i)));
+            energy -= (double) G * particles.mass[i] * particles.mass[j] / r;
+        }
+    }
+    return energy;
+}
+
+int test_hermite()
+{
+    // A tight binary orbited by a swarm of light bodies far out: the binary
+    //   needs short steps, the swarm does not
+    const float M = 100.0f, a = 1.0f;
+    const float vBinary = std::sqrt(G * M / (4.0f * a));
+    ParticleStore particles;
+    particles.push_back(glm::vec3(-a, 0.0f, 0.0f), glm::vec3(0.0f, -vBinary, 0.0f), M, 0.01f);
+    particles.push_back(glm::vec3(a, 0.0f, 0.0f), glm::vec3(0.0f, vBinary, 0.0f), M, 0.01f);
+    std::default_random_engine randEngine(7);
+    std::uniform_real_distribution<float> radius_dist(100, 200), angle_dist(0, 2 * M_PI);
+    for(int k = 0; k < 126; k++) {
+        float r = radius_dist(randEngine), phi = angle_dist(randEngine);
+        float v = std::sqrt(G * 2.0f * M / r);
+        particles.push_back(r * glm::vec3(std::cos(phi), std::sin(phi), 0.0f),
+                            v * glm::vec3(-std::sin(phi), std::cos(phi), 0.0f), 0.01f, 0.01f);
+    }
+
+    HermiteIntegrator hermite(0.02f);
+    const double initial = totalEnergy(particles);
+    const float binaryPeriod = 2.0f * M_PI * a / vBinary;
+    size_t blocks = 0, bodySteps = 0, finest = 0;
+    for(int k = 0; k < 10; k++) {
+        hermite.step(particles, G, binaryPeriod, 1);
+        blocks += hermite.getBlockCount();
+        bodySteps += hermite.getBodySteps();
+        finest = std::max(finest, hermite.getBlockCount());
+    }
+    double drift = std::fabs(totalEnergy(particles) / initial - 1.0);
+    // What a shared step at the finest level would have cost
+    double shared = (double) particles.size() * finest * 10;
+    std::cout << "Hermite energy drift: " << drift << ", body steps: " << bodySteps << " in " << blocks
+              << " blocks (shared step: " << shared << ")" << std::endl;
+    if(drift > 1e-4 || bodySteps * 10 > shared) {
+        return 1;
+    }
+    return 0;
+}
+
+int test_task_scheduler()
+{
+    TaskScheduler scheduler(4);
+    // Every index visited exactly once, with nested loops inside the chunks
+    const size_t N = 10000;
+    std::vector<int> visits(N, 0);
+    scheduler.parallelFor(0, N / 100, 3, [&](size_t begin, size_t end) {
+        for(size_t block = begin; block < end; block++) {
+            scheduler.parallelFor(block * 100, (block + 1) * 100, 7, [&](size_t first, size_t last) {
+                for(size_t i = first; i < last; i++) {
+                    visits[i]++;
+                }
+            });
+        }
+    });
+    for(int count : visits) {
+        if(count != 1) {
+            return 1;
+        }
+    }
+
+    long long sum = scheduler.parallelReduce(0, N, 37, 0LL,
+        [](size_t begin, size_t end) {
+            long long partial = 0;
+            for(size_t i = begin; i < end; i++) {
+                partial += i;
+            }
+            return partial;
+        },
+        [](long long a, long long b) { return a + b; });
+    if(sum != (long long) N * (N - 1) / 2) {
+        return 1;
+    }
+
+    // Diamond: both middle tasks after the first, the last after both
+    std::atomic<int> clock(0);
+    int first = -1, left = -1, right = -1, last = -1;
+    TaskGraph graph;
+    TaskGraph::TaskId a = graph.add([&]() { first = clock++; });
+    TaskGraph::TaskId b = graph.add([&]() { left = clock++; }, {a});
+    TaskGraph::TaskId c = graph.add([&]() { right = clock++; }, {a});
+    graph.add([&]() { last = clock++; }, {b, c});
+    graph.run(scheduler);
+    std::cout << "Task scheduler: " << scheduler.getThreadCount() << " threads, sum " << sum << std::endl;
+    if(first != 0 || left <= first || right <= first || last != 3) {
+        return 1;
+    }
+
+    // A static partition hands every index to the same thread each time
+    scheduler.setStaticPartition(true);
+    std::vector<std::thread::id> owners[2];
+    for(int pass = 0; pass < 2; pass++) {
+        owners[pass].resize(N);
+        scheduler.parallelFor(0, N, 16, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) {
+                owners[pass][i] = std::this_thread::get_id();
+            }
+        });
+    }
+    if(owners[0] != owners[1] || owners[0].front() == owners[0].back()) {
+        return 1;
+    }
+
+    // Bound blocks must reach their owners however the workers are woken:
+    //   many small static loops, some with fewer items than threads
+    TaskScheduler wide(8);
+    wide.setStaticPartition(true);
+    for(int pass = 0; pass < 20000; pass++) {
+        const size_t count = pass % 2 == 0 ? 5 : 8000;
+        std::atomic<size_t> visited(0);
+        wide.parallelFor(0, count, 64, [&](size_t begin, size_t end) { visited += end - begin; });
+        if(visited != count) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int test_frame_graph()
+{
+    // A worker fills one of two buffers per frame and the main thread reads
+    //   it back; each read must see its own frame's value even though the
+    //   next frame may already be filling the other buffer
+    TaskScheduler scheduler(3);
+    FrameGraph graph(scheduler);
+    graph.addResource("buffer", 2);
+    graph.addResource("log");
+    uint64_t buffers[2] = {0, 0};
+    std::vector<uint64_t> seen;
+    bool wrongThread = false;
+    const std::thread::id mainThread = std::this_thread::get_id();
+    graph.addStage("produce", FrameThread::Worker, {}, {"buffer"}, [&](uint64_t frame) {
+        buffers[frame % 2] = frame + 1;
+    });
+    graph.addStage("consume", FrameThread::Main, {"buffer"}, {"log"}, [&](uint64_t frame) {
+        wrongThread |= std::this_thread::get_id() != mainThread;
+        seen.push_back(buffers[frame % 2]);
+    });
+    const uint64_t frames = 200;
+    for(uint64_t frame = 0; frame < frames; frame++) {
+        graph.runFrame();
+    }
+    graph.finish();
+    std::cout << "Frame graph: " << seen.size() << " frames" << std::endl;
+    if(wrongThread || seen.size() != frames) {
+        return 1;
+    }
+    for(uint64_t frame = 0; frame < frames; frame++) {
+        if(seen[frame] != frame + 1) {
+            return 1;
+        }
+    }
+
+    // The render loop's layout: the view, render state and instance region
+    //   have a copy per frame in flight and the draw doesn't touch the
+    //   camera, so the next frame's worker stages run while this frame's
+    //   draw is still going
+    FrameGraph pipeline(scheduler);
+    pipeline.addResource("camera");
+    pipeline.addResource("view", 2);
+    pipeline.addResource("snapshot");
+    pipeline.addResource("renderState", 2);
+    pipeline.addResource("instances", 2);
+    pipeline.addResource("framebuffer");
+    std::atomic<uint64_t> interpolated(0);
+    uint64_t overlapped = 0;
+    pipeline.addStage("input", FrameThread::Main, {}, {"camera"}, [](uint64_t) {});
+    pipeline.addStage("gravitateCamera", FrameThread::Worker, {"snapshot"}, {"camera", "view"}, [](uint64_t) {});
+    pipeline.addStage("interpolate", FrameThread::Worker, {"view"}, {"snapshot", "renderState", "instances"}, [&](uint64_t frame) {
+        interpolated = frame + 1;
+    });
+    pipeline.addStage("draw", FrameThread::Main, {"renderState"}, {"instances", "framebuffer"}, [&](uint64_t frame) {
+        // Hold the draw until the next frame has been interpolated, or give
+        //   up if it can't start before the draw is over
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+        while(interpolated.load() < frame + 2 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::yield();
+        }
+        overlapped += interpolated.load() >= frame + 2;
+    });
+    pipeline.addStage("present", FrameThread::Main, {}, {"framebuffer"}, [](uint64_t) {});
+    for(uint64_t frame = 0; frame < 50; frame++) {
+        pipeline.runFrame();
+    }
+    pipeline.finish();
+    std::cout << "Frame graph: next frame interpolated during " << overlapped << " of 50 draws" << std::endl;
+    // Only the last draw has no next frame
+    if(overlapped != 49) {
+        return 1;
+    }
+    return 0;
+}
+
+int test_triple_buffer()
+{
+    // The writer fills every element with its sequence number; the reader
+    //   must never see a torn buffer or go backwards
+    TripleBuffer<std::vector<int>> buffer;
+    const int count = 20000;
+    std::thread writer([&buffer]() {
+        for(int k = 1; k <= count; k++) {
+            buffer.writeBuffer().assign(64, k);
+            buffer.publish();
+            std::this_thread::yield();
+        }
+    });
+    int last = 0, acquired = 0;
+    bool failed = false;
+    while(last < count && !failed) {
+        if(!buffer.acquire()) {
+            continue;
+        }
+        const std::vector<int>& state = buffer.readBuffer();
+        for(int value : state) {
+            failed |= value != state[0];
+        }
+        failed |= state.size() != 64 || state[0] <= last;
+        last = state[0];
+        acquired++;
+    }
+    writer.join();
+    std::cout << "Triple buffer: " << acquired << " of " << count << " states read, last " << last << std::endl;
+    return failed ? 1 : 0;
+}
+
+int test_sphere_lods()
+{
+    // Every level must index only its own vertices, and each must be
+    //   coarser than the one before
+    Sphere sphere;
+    const std::vector<SphereLod>& lods = sphere.getLods();
+    const std::vector<GLuint>& indices = sphere.getIndices();
+    const size_t vertexCount = sphere.getVertices().size() / 6;
+    if(lods.size() != SPHERE_LOD_COUNT || lods.back().firstIndex + lods.back().indexCount != indices.size()) {
+        return 1;
+    }
+    size_t firstVertex = 0;
+    for(size_t level = 0; level < lods.size(); level++) {
+        const GLuint resolution = lods[level].resolution;
+        const size_t lastVertex = firstVertex + resolution * resolution;
+        if(lods[level].indexCount != 6 * (resolution - 1) * (resolution - 1) || lastVertex > vertexCount) {
+            return 1;
+        }
+        if(level > 0 && lods[level].indexCount >= lods[level - 1].indexCount) {
+            return 1;
+        }
+        for(GLuint k = 0; k < lods[level].indexCount; k++) {
+            const GLuint index = indices[lods[level].firstIndex + k];
+            if(index < firstVertex || index >= lastVertex) {
+                return 1;
+            }
+        }
+        std::cout << "Sphere LOD " << level << ": " << lods[level].indexCount / 3 << " triangles" << std::endl;
+        firstVertex = lastVertex;
+    }
+    return firstVertex == vertexCount ? 0 : 1;
+}
+
+int test_lod_selection()
+{
+    // The camera sits at the origin looking down -z
+    const glm::mat4 view(1.0f);
+    const float pixelScale = 1000.0f;
+    const GLuint coarsest = SPHERE_LOD_COUNT - 1;
+    if(InstanceWriter::selectLod(glm::vec3(0.0f, 0.0f, 5.0f), 1.0f, view, pixelScale) != coarsest
+       || InstanceWriter::selectLod(glm::vec3(0.0f, 0.0f, -0.5f), 1.0f, view, pixelScale) != 0
+       || InstanceWriter::selectLod(glm::vec3(0.0f, 0.0f, 0.5f), 1.0f, view, pixelScale) != 0) {
+        std::cout << "LOD selection behind or around the camera is wrong" << std::endl;
+        return 1;
+    }
+
+    // Moving away never asks for a finer level, and passes through them all
+    GLuint previous = 0;
+    std::vector<bool> seen(SPHERE_LOD_COUNT, false);
+    for(float depth = 1.5f; depth < 1e5f; depth *= 1.01f) {
+        const GLuint level = InstanceWriter::selectLod(glm::vec3(0.0f, 0.0f, -depth), 1.0f, view, pixelScale);
+        const GLuint larger = InstanceWriter::selectLod(glm::vec3(0.0f, 0.0f, -depth), 1.5f, view, pixelScale);
+        if(level < previous || larger > level) {
+            std::cout << "LOD selection is not monotonic at depth " << depth << std::endl;
+            return 1;
+        }
+        seen[level] = true;
+        previous = level;
+    }
+    for(GLuint level = 0; level < SPHERE_LOD_COUNT; level++) {
+        if(!seen[level]) {
+            std::cout << "LOD " << level << " is never selected" << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "LOD selection: monotonic over " << SPHERE_LOD_COUNT << " levels" << std::endl;
+    return 0;
+}
+
+int test_frustum()
+{
+    // Camera at the origin looking down -z with a 90 degree field of view:
+    //   spheres are kept while any part of them is inside
+    const glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 100.0f);
+    const glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    const Frustum frustum(projection * view);
+    const bool ahead = frustum.containsSphere(glm::vec3(0.0f, 0.0f, -10.0f), 1.0f);
+    const bool behind = frustum.containsSphere(glm::vec3(0.0f, 0.0f, 10.0f), 1.0f);
+    const bool beyondFar = frustum.containsSphere(glm::vec3(0.0f, 0.0f, -102.0f), 1.0f);
+    // 12 to the side at depth 10 is 2 / sqrt(2) outside the right plane
+    const bool outside = frustum.containsSphere(glm::vec3(12.0f, 0.0f, -10.0f), 1.0f);
+    const bool straddling = frustum.containsSphere(glm::vec3(12.0f, 0.0f, -10.0f), 1.5f);
+    const bool everything = Frustum().containsSphere(glm::vec3(1e6f), 1.0f);
+    if(!ahead || behind || beyondFar || outside || !straddling || !everything) {
+        return 1;
+    }
+
+    // The batched cull, with a tail past the last full batch, must keep the
+    //   same spheres and give their distances in front of the near plane
+    const size_t count = 1003;
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<float> coordinate(-120.0f, 120.0f), size(0.1f, 5.0f);
+    std::vector<float> x(count), y(count), z(count), radius(count), depth(count);
+    std::vector<unsigned char> visible(count);
+    for(size_t i = 0; i < count; i++) {
+        x[i] = coordinate(generator);
+        y[i] = coordinate(generator);
+        z[i] = coordinate(generator);
+        radius[i] = size(generator);
+    }
+    size_t kept = cullSpheres(frustum, x.data(), y.data(), z.data(), radius.data(), count, visible.data(), depth.data());
+    size_t expected = 0;
+    for(size_t i = 0; i < count; i++) {
+        const glm::vec3 center(x[i], y[i], z[i]);
+        const bool inside = frustum.containsSphere(center, radius[i]);
+        expected += inside;
+        const float nearDistance = glm::dot(glm::vec3(frustum.planes[4]), center) + frustum.planes[4].w;
+        if(visible[i] != inside || (inside && std::abs(depth[i] - nearDistance) > 1e-4f * std::max(1.0f, std::abs(nearDistance)))) {
+            return 1;
+        }
+    }
+    std::cout << "Frustum culling kept " << kept << " of " << count << " spheres" << std::endl;
+    return kept == expected && kept > 0 ? 0 : 1;
+}
+
+int test_barnes_hut()
+{
+    ParticleStore particles;
+    makeBodies(particles);
+    std::vector<glm::vec3> exact = directAccelerations(particles.view());
+
+    // theta = 0 opens every cell, so it must agree with direct summation
+    BarnesHut exactTree(0.0f, false);
+    exactTree.computeAccelerations(particles.view(), G, particles.accelerations(), 4);
+    float exactError = relativeError(particles.accelerations(), exact);
+
+    BarnesHut monopole(0.5f, false);
+    monopole.computeAccelerations(particles.view(), G, particles.accelerations(), 4);
+    float monopoleError = relativeError(particles.accelerations(), exact);
+
+    BarnesHut quadrupole(0.5f, true);
+    quadrupole.computeAccelerations(particles.view(), G, particles.accelerations(), 4);
+    float quadrupoleError = relativeError(particles.accelerations(), exact);
+
+    std::cout << "Barnes-Hut error theta=0: " << exactError << ", monopole: " << monopoleError
+              << ", quadrupole: " << quadrupoleError << std::endl;
+    if(exactError > 1e-4 || monopoleError > 2e-2 || quadrupoleError > monopoleError) {
+        return 1;
+    }
+    return 0;
+}
+
+int test_fast_multipole()
+{
+    ParticleStore particles;
+    makeBodies(particles);
+    std::vector<glm::vec3> exact = directAccelerations(particles.view());
+
+    // Raising the expansion order has to keep buying accuracy
+    float previousError = 1.0f;
+    for(int order = 2; order <= 6; order += 2) {
+        FastMultipole fmm(order, 0.5f);
+        fmm.computeAccelerations(particles.view(), G, particles.accelerations(), 4);
+        float error = relativeError(particles.accelerations(), exact);
+        float sampledError = FastMultipole::measureError(particles.view(), G, particles.accelerations(), BODY_COUNT);
+        std::cout << "FMM error p=" << order << ": " << error << " (sampled " << sampledError << ")" << std::endl;
+        if(error >= previousError || std::fabs(error - sampledError) > 1e-3 * error + 1e-6) {
+            return 1;
+        }
+        previousError = error;
+    }
+    return previousError < 1e-3 ? 0 : 1;
+}
+
+int test_particle_mesh()
+{
+    ParticleStore particles;
+    makeBodies(particles);
+    std::vector<glm::vec3> exact = directAccelerations(particles.view());
+
+    // Mesh-only error is dominated by pairs closer than a cell, so it is loose overall
+    ParticleMesh meshOnly(64, false);
+    meshOnly.computeAccelerations(particles.view(), G, particles.accelerations(), 4);
+    float meshError = relativeError(particles.accelerations(), exact);
+
+    // The short-range correction restores the close encounters the mesh smooths away
+    ParticleMesh p3m(64, true);
+    p3m.computeAccelerations(particles.view(), G, particles.accelerations(), 4);
+    float p3mError = relativeError(particles.accelerations(), exact);
+
+    // Far from every source the mesh alone is accurate: light probes on a
+    //   shell tens of cells away from a compact heavy cluster
+    ParticleStore separated;
+    std::default_random_engine randEngine(31);
+    std::normal_distribution<float> cluster_dist(0, 5);
+    std::normal_distribution<float> direction_dist(0, 1);
+    const int CLUSTER_COUNT = 200, PROBE_COUNT = 100;
+    for(int i = 0; i < CLUSTER_COUNT; i++) {
+        glm::vec3 location(cluster_dist(randEngine), cluster_dist(randEngine), cluster_dist(randEngine));
+        separated.push_back(location, glm::vec3(0.0f), 100.0f, 0.01f);
+    }
+    for(int i = 0; i < PROBE_COUNT; i++) {
+        glm::vec3 direction(direction_dist(randEngine), direction_dist(randEngine), direction_dist(randEngine));
+        separated.push_back(400.0f * glm::normalize(direction), glm::vec3(0.0f), 1e-3f, 0.01f);
+    }
+    std::vector<glm::vec3> separatedExact = directAccelerations(separated.view());
+    meshOnly.computeAccelerations(separated.view(), G, separated.accelerations(), 4);
+    float farError = 0.0f;
+    for(int i = CLUSTER_COUNT; i < CLUSTER_COUNT + PROBE_COUNT; i++) {
+        glm::vec3 a = separated.accelerations().get(i);
+        farError = std::max(farError, glm::length(a - separatedExact[i]) / glm::length(separatedExact[i]));
+    }
+
+    std::cout << "PM error: " << meshError << ", P3M: " << p3mError << ", PM far field: " << farError << std::endl;
+    if(meshError > 0.7 || farError > 1e-2 || p3mError > 2e-2 || p3mError > meshError) {
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    // Exercise the engines' parallel paths even on a single core
+    TaskScheduler::shared().setThreadCount(4);
+    int result;
+    result = test_particle_store();
+    if(result != 0)
+        return result;
+
+    result = test_direct_kernel();
+    if(result != 0)
+        return result;
+
+    result = test_parallel_direct();
+    if(result != 0)
+        return result;
+
+    result = test_spatial_hash();
+    if(result != 0)
+        return result;
+
+    result = test_sphere_merger();
+    if(result != 0)
+        return result;
+
+    result = test_integrators();
+    if(result != 0)
+        return result;
+
+    result = test_hermite();
+    if(result != 0)
+        return result;
+
+    result = test_task_scheduler();
+    if(result != 0)
+        return result;
+
+    result = test_frame_graph();
+    if(result != 0)
+        return result;
+
+    result = test_triple_buffer();
+    if(result != 0)
+        return result;
+
+    result = test_sphere_lods();
+    if(result != 0)
+        return result;
+
+    result = test_lod_selection();
+    if(result != 0)
+        return result;
+
+    result = test_frustum();
+    if(result != 0)
+        return result;
+
+    result = test_instance_format();
+    if(result != 0)
+        return result;
+
+    result = test_instance_reuse();
+    if(result != 0)
+        return result;
+
+    result = test_instance_order();
+    if(result != 0)
+        return result;
+
+    result = test_barnes_hut();
+    if(result != 0)
+        return result;
+
+    result = test_fast_multipole();
+    if(result != 0)
+        return result;
+
+    result = test_particle_mesh();
+
+    if(result != 0)
+        return result;
+    return 0;
+}